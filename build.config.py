@@ -18,6 +18,9 @@ if "sanitize" in opt:
     lflags += [ "-fsanitize=address" ]
     cflags += [ "-fsanitize=address" ]
 
+if "native" in opt:
+    cflags += [ "-march=native" ]
+
 if "release" in opt:
     cflags += [ "-O3", "-ffast-math" ]
     lflags += [ "-s" ]
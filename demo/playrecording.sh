@@ -1 +0,0 @@
-play -t raw -r 44100 -e floating-point -b 32 -c 2 demo/out.raw
@@ -10,6 +10,9 @@ static const char *node_error_strings[] = {
   "bad outlet",
   "bad link",
   "max links exceeded",
+  "bad node id",
+  "bad node name",
+  "max nodes exceeded",
 };
 
 
@@ -46,25 +49,140 @@ static fe_Object* f_set_stream(fe_Context *ctx, fe_Object *arg) {
   } else {
     filename = NULL;
   }
-  int err = dsp_set_stream(filename);
+  int bits = 32;
+  if (filename && !fe_isnil(ctx, arg)) {
+    bits = fe_tonumber(ctx, fe_nextarg(ctx, &arg));
+    if (bits != 16 && bits != 24 && bits != 32) {
+      fe_error(ctx, "expected 16, 24 or 32 bits");
+    }
+  }
+  int err = dsp_set_stream(filename, bits);
   if (err) { fe_error(ctx, "failed to open stream"); }
   return fe_bool(ctx, false);
 }
 
 
+static fe_Object* f_set_threads(fe_Context *ctx, fe_Object *arg) {
+  int n = fe_tonumber(ctx, fe_nextarg(ctx, &arg));
+  bool deterministic = false;
+  if (!fe_isnil(ctx, arg)) {
+    deterministic = !fe_isnil(ctx, fe_nextarg(ctx, &arg));
+  }
+  if (n < 1) { fe_error(ctx, "expected thread count greater than 0"); }
+  check_node_error(ctx, dsp_set_threads(n, deterministic));
+  return fe_bool(ctx, false);
+}
+
+
+static fe_Object* f_set_profile(fe_Context *ctx, fe_Object *arg) {
+  bool enabled = !fe_isnil(ctx, fe_nextarg(ctx, &arg));
+  check_node_error(ctx, dsp_set_profile(enabled));
+  return fe_bool(ctx, false);
+}
+
+
+static fe_Object* stat_to_list(fe_Context *ctx, DspStat *st, bool type) {
+  fe_Object *objs[] = {
+    type ? fe_symbol(ctx, st->name) : fe_number(ctx, st->id),
+    type ? fe_number(ctx, st->count) : fe_symbol(ctx, st->name),
+    fe_number(ctx, st->avg),
+    fe_number(ctx, st->max),
+    fe_number(ctx, st->p50),
+    fe_number(ctx, st->p99),
+  };
+  return fe_list(ctx, objs, 6);
+}
+
+
+static fe_Object* stats_to_list(fe_Context *ctx, DspStat *st, int n, bool type) {
+  fe_Object *res = fe_bool(ctx, false);
+  int gc = fe_savegc(ctx);
+  for (int i = n - 1; i >= 0; i--) {
+    res = fe_cons(ctx, stat_to_list(ctx, &st[i], type), res);
+    fe_restoregc(ctx, gc);
+    fe_pushgc(ctx, res);
+  }
+  return res;
+}
+
+
+/* returns:
+** ((load . n) (max-load . n) (stream-dropped . n)
+**  (nodes (id type avg max p50 p99) ...)
+**  (types (type count avg max p50 p99) ...)) */
+static fe_Object* f_stats(fe_Context *ctx, fe_Object *arg) {
+  const DspStats *stats = dsp_get_stats();
+  fe_Object *objs[] = {
+    fe_cons(ctx, fe_symbol(ctx, "load"), fe_number(ctx, stats->load)),
+    fe_cons(ctx, fe_symbol(ctx, "max-load"), fe_number(ctx, stats->max_load)),
+    fe_cons(ctx, fe_symbol(ctx, "stream-dropped"), fe_number(ctx, stats->stream_dropped)),
+    fe_cons(ctx, fe_symbol(ctx, "nodes"),
+      stats_to_list(ctx, stats->nodes, stats->node_count, false)),
+    fe_cons(ctx, fe_symbol(ctx, "types"),
+      stats_to_list(ctx, stats->types, stats->type_count, true)),
+  };
+  return fe_list(ctx, objs, 5);
+}
+
+
+static int compare_stat_avg(const void *a, const void *b) {
+  const DspStat *x = a, *y = b;
+  return (x->avg < y->avg) - (x->avg > y->avg);
+}
+
+
+static fe_Object* f_print_stats(fe_Context *ctx, fe_Object *arg) {
+  char buf[128];
+  const DspStats *stats = dsp_get_stats();
+  sprintf(buf, "load %.1f%% (max %.1f%%)", stats->load, stats->max_load);
+  app_log(buf);
+  if (stats->stream_dropped) {
+    sprintf(buf, "stream dropped %d frames", stats->stream_dropped);
+    app_log(buf);
+  }
+
+  app_log("type       count   avg us   max us   p50 us   p99 us");
+  for (int i = 0; i < stats->type_count; i++) {
+    DspStat *st = &stats->types[i];
+    sprintf(buf, "%-10.10s %5d %8.2f %8.2f %8.2f %8.2f",
+      st->name, st->count, st->avg, st->max, st->p50, st->p99);
+    app_log(buf);
+  }
+
+  /* show the most expensive nodes */
+  qsort(stats->nodes, stats->node_count, sizeof(DspStat), compare_stat_avg);
+  app_log("node          id   avg us   max us   p50 us   p99 us");
+  for (int i = 0; i < stats->node_count && i < 10; i++) {
+    DspStat *st = &stats->nodes[i];
+    sprintf(buf, "%-10.10s %5d %8.2f %8.2f %8.2f %8.2f",
+      st->name, st->id, st->avg, st->max, st->p50, st->p99);
+    app_log(buf);
+  }
+  return fe_bool(ctx, false);
+}
+
+
 static fe_Object* f_new(fe_Context *ctx, fe_Object *arg) {
   char name[128];
   fe_tostring(ctx, fe_nextarg(ctx, &arg), name, sizeof(name));
   int id = dsp_new_node(name);
-  if (id < 0) { fe_error(ctx, "bad node name"); }
+  if (id < 0) { check_node_error(ctx, id); }
   return fe_number(ctx, id);
 }
 
 
+static fe_Object* f_reserve(fe_Context *ctx, fe_Object *arg) {
+  char name[128];
+  fe_tostring(ctx, fe_nextarg(ctx, &arg), name, sizeof(name));
+  int count = fe_tonumber(ctx, fe_nextarg(ctx, &arg));
+  check_node_error(ctx, dsp_reserve(name, count));
+  return fe_bool(ctx, false);
+}
+
+
 static fe_Object* f_destroy(fe_Context *ctx, fe_Object *arg) {
   int id = fe_tonumber(ctx, fe_nextarg(ctx, &arg));
-  int err = dsp_destroy_node(id);
-  if (err) { fe_error(ctx, "bad node id"); }
+  check_node_error(ctx, dsp_destroy_node(id));
   return fe_bool(ctx, false);
 }
 
@@ -76,7 +194,7 @@ static fe_Object* f_link(fe_Context *ctx, fe_Object *arg) {
   Node *node2 = get_node(ctx, fe_tonumber(ctx, fe_nextarg(ctx, &arg)));
   fe_tostring(ctx, fe_nextarg(ctx, &arg), inlet, sizeof(inlet));
 
-  check_node_error(ctx, node_link(node1, outlet, node2, inlet));
+  check_node_error(ctx, dsp_link(node1, outlet, node2, inlet));
   return fe_bool(ctx, false);
 }
 
@@ -88,7 +206,7 @@ static fe_Object* f_unlink(fe_Context *ctx, fe_Object *arg) {
   Node *node2 = get_node(ctx, fe_tonumber(ctx, fe_nextarg(ctx, &arg)));
   fe_tostring(ctx, fe_nextarg(ctx, &arg), inlet, sizeof(inlet));
 
-  check_node_error(ctx, node_link(node1, outlet, node2, inlet));
+  check_node_error(ctx, dsp_unlink(node1, outlet, node2, inlet));
   return fe_bool(ctx, false);
 }
 
@@ -99,7 +217,35 @@ static fe_Object* f_set(fe_Context *ctx, fe_Object *arg) {
   fe_tostring(ctx, fe_nextarg(ctx, &arg), inlet, sizeof(inlet));
   float value = fe_tonumber(ctx, fe_nextarg(ctx, &arg));
 
-  check_node_error(ctx, node_set(node, inlet, value));
+  check_node_error(ctx, dsp_set(node, inlet, value));
+  return fe_bool(ctx, false);
+}
+
+
+static fe_Object* f_set_at(fe_Context *ctx, fe_Object *arg) {
+  char inlet[64];
+  Node *node = get_node(ctx, fe_tonumber(ctx, fe_nextarg(ctx, &arg)));
+  fe_tostring(ctx, fe_nextarg(ctx, &arg), inlet, sizeof(inlet));
+  float value = fe_tonumber(ctx, fe_nextarg(ctx, &arg));
+  float delay = fe_tonumber(ctx, fe_nextarg(ctx, &arg));
+
+  check_node_error(ctx, dsp_set_at(node, inlet, value, delay));
+  return fe_bool(ctx, false);
+}
+
+
+static fe_Object* f_ramp(fe_Context *ctx, fe_Object *arg) {
+  char inlet[64], mode[16] = "linear";
+  Node *node = get_node(ctx, fe_tonumber(ctx, fe_nextarg(ctx, &arg)));
+  fe_tostring(ctx, fe_nextarg(ctx, &arg), inlet, sizeof(inlet));
+  float time = fe_tonumber(ctx, fe_nextarg(ctx, &arg));
+  if (!fe_isnil(ctx, arg)) {
+    fe_tostring(ctx, fe_nextarg(ctx, &arg), mode, sizeof(mode));
+  }
+  bool exp = !strcmp(mode, "exp");
+  if (!exp && strcmp(mode, "linear")) { fe_error(ctx, "expected 'linear or 'exp"); }
+
+  check_node_error(ctx, dsp_ramp(node, inlet, time, exp));
   return fe_bool(ctx, false);
 }
 
@@ -110,30 +256,53 @@ static fe_Object* f_get(fe_Context *ctx, fe_Object *arg) {
   Node *node = get_node(ctx, fe_tonumber(ctx, fe_nextarg(ctx, &arg)));
   fe_tostring(ctx, fe_nextarg(ctx, &arg), outlet, sizeof(outlet));
   check_node_error(ctx, node_get(node, outlet, &res));
+  dsp_observe(node);
   return fe_number(ctx, res);
 }
 
 
 static fe_Object* f_send(fe_Context *ctx, fe_Object *arg) {
-  char str[1024];
-  char err_buf[NODE_MAX_ERROR];
+  char str[NODE_MAX_MESSAGE];
+  Node *node = get_node(ctx, fe_tonumber(ctx, fe_nextarg(ctx, &arg)));
+  fe_tostring(ctx, fe_nextarg(ctx, &arg), str, sizeof(str));
+  check_node_error(ctx, dsp_send(node, str));
+  return fe_bool(ctx, false);
+}
+
+
+static fe_Object* f_send_at(fe_Context *ctx, fe_Object *arg) {
+  char str[NODE_MAX_MESSAGE];
   Node *node = get_node(ctx, fe_tonumber(ctx, fe_nextarg(ctx, &arg)));
   fe_tostring(ctx, fe_nextarg(ctx, &arg), str, sizeof(str));
-  int err = node->vtable->receive(node, str, err_buf);
-  if (err) { fe_error(ctx, err_buf); }
+  float delay = fe_tonumber(ctx, fe_nextarg(ctx, &arg));
+  check_node_error(ctx, dsp_send_at(node, str, delay));
   return fe_bool(ctx, false);
 }
 
 
+static fe_Object* f_time(fe_Context *ctx, fe_Object *arg) {
+  return fe_number(ctx, dsp_time());
+}
+
+
 fex_Reg api_dsp[] = {
-  { "dsp:set-tick",   f_set_tick   },
-  { "dsp:set-stream", f_set_stream },
-  { "dsp:new",        f_new        },
-  { "dsp:destroy",    f_destroy    },
-  { "dsp:link",       f_link       },
-  { "dsp:unlink",     f_unlink     },
-  { "dsp:set",        f_set        },
-  { "dsp:get",        f_get        },
-  { "dsp:send",       f_send       },
+  { "dsp:set-tick",    f_set_tick    },
+  { "dsp:set-stream",  f_set_stream  },
+  { "dsp:set-threads", f_set_threads },
+  { "dsp:set-profile", f_set_profile },
+  { "dsp:stats",       f_stats       },
+  { "dsp:print-stats", f_print_stats },
+  { "dsp:new",         f_new         },
+  { "dsp:reserve",     f_reserve     },
+  { "dsp:destroy",     f_destroy     },
+  { "dsp:link",        f_link        },
+  { "dsp:unlink",      f_unlink      },
+  { "dsp:set",         f_set         },
+  { "dsp:set-at",      f_set_at      },
+  { "dsp:ramp",        f_ramp        },
+  { "dsp:get",         f_get         },
+  { "dsp:send",        f_send        },
+  { "dsp:send-at",     f_send_at     },
+  { "dsp:time",        f_time        },
   {},
 };
@@ -180,17 +180,19 @@ static fe_Object* f_scope(fe_Context *ctx, fe_Object *arg) {
   char outlet[64];
   Node *node = dsp_get_node(fe_tonumber(ctx, fe_nextarg(ctx, &arg)));
   fe_tostring(ctx, fe_nextarg(ctx, &arg), outlet, sizeof(outlet));
+  if (!node) { fe_error(ctx, "bad node id"); }
   int idx = string_to_enum(node->info->outlets, outlet);
-
-  if (!node  ) { fe_error(ctx, "bad node id"); }
-  if (idx < 0) { fe_error(ctx, "bad outlet");  }
+  if (idx < 0) { fe_error(ctx, "bad outlet"); }
+  dsp_observe(node);
 
   mu_Rect r = mu_layout_next(app.mu_ctx);
   app.mu_ctx->draw_frame(app.mu_ctx, r, MU_COLOR_BASE);
 
+  /* the last block processed may have been shortened by an event */
   float *buf = node->outlets[idx].buf;
+  int frames = atomic_load_explicit(&node->frames, memory_order_relaxed);
   for (int i = 0; i < r.w; i++) {
-    float p = i * (NODE_BUFFER_SIZE - 1) / (float) r.w;
+    float p = i * (frames - 1) / (float) r.w;
     int n = p;
     float val = lerpf(buf[n], buf[n + 1], p - n);
     int h = clampf(fabs(val * r.h / 2), 1, r.h / 2);
@@ -2,11 +2,23 @@
 #include <setjmp.h>
 #include <unistd.h>
 #include "dsp/dsp.h"
+#include "dsp/wav.h"
 #include "midi.h"
 #include "app.h"
 
 App app;
 
+#define RENDER_FRAMES 1024
+
+static struct {
+  bool headless;
+  const char *script;
+  double seconds;
+  WavFile wav;
+} render;
+
+static DspConfig dsp_config = { .samplerate = 44100, .channels = 2 };
+
 
 static void tick_callback(void) {
   app_fe_push();
@@ -15,6 +27,13 @@ static void tick_callback(void) {
 }
 
 
+static void dsp_error_callback(const char *msg) {
+  char buf[256];
+  sprintf(buf, "error: %.200s", msg);
+  app_log_error(buf);
+}
+
+
 static void midi_callback(MidiMessage msg) {
   const char *type;;
   switch (midi_type(msg)) {
@@ -36,8 +55,99 @@ static void midi_callback(MidiMessage msg) {
 static mu_Container console_win;
 
 
+static void parse_args(int argc, char **argv) {
+  const char *dir = NULL;
+  const char *out = "out.wav";
+  int bits = 32;
+  render.script = "main.fe";
+  render.seconds = 60;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--render")) {
+      render.headless = true;
+      if (i + 1 < argc && strncmp(argv[i + 1], "--", 2)) {
+        render.script = argv[++i];
+      }
+    } else if (!strcmp(argv[i], "--seconds") && i + 1 < argc) {
+      render.seconds = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--out") && i + 1 < argc) {
+      out = argv[++i];
+    } else if (!strcmp(argv[i], "--bits") && i + 1 < argc) {
+      bits = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--samplerate") && i + 1 < argc) {
+      dsp_config.samplerate = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--block-size") && i + 1 < argc) {
+      dsp_config.block_size = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--device-frames") && i + 1 < argc) {
+      dsp_config.device_frames = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--channels") && i + 1 < argc) {
+      dsp_config.channels = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--lock-memory")) {
+      dsp_config.lock_memory = true;
+    } else if (!dir) {
+      dir = argv[i];
+    } else {
+      fprintf(stderr, "usage: aq [dir] [--render [script]] "
+                      "[--seconds n] [--out file.wav] [--bits n]\n"
+                      "          [--samplerate n] [--block-size n] "
+                      "[--device-frames n] [--channels n] [--lock-memory]\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  if (dsp_config.samplerate <= 0) {
+    fprintf(stderr, "error: expected samplerate greater than 0\n");
+    exit(EXIT_FAILURE);
+  }
+  if (dsp_config.channels < 1 || dsp_config.channels > NODE_MAX_CHANNELS) {
+    fprintf(stderr, "error: expected 1 to %d channels\n", NODE_MAX_CHANNELS);
+    exit(EXIT_FAILURE);
+  }
+
+  /* open output before changing directory so relative paths behave */
+  if (render.headless) {
+    if (bits != 16 && bits != 24 && bits != 32) {
+      fprintf(stderr, "error: expected 16, 24 or 32 bits\n");
+      exit(EXIT_FAILURE);
+    }
+    if (wav_open(&render.wav, out, dsp_config.samplerate, dsp_config.channels, bits)) {
+      fprintf(stderr, "error: could not open '%s'\n", out);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  if (dir) { expect( chdir(dir) == 0 ); }
+
+  /* run the script from its own directory so `do-file` paths resolve */
+  const char *slash = strrchr(render.script, '/');
+  if (slash) {
+    char buf[1024];
+    int len = slash - render.script;
+    expect(len < sizeof(buf));
+    memcpy(buf, render.script, len);
+    buf[len] = '\0';
+    expect( len == 0 || chdir(buf) == 0 );
+    render.script = slash + 1;
+  }
+}
+
+
 void app_init(int argc, char **argv) {
-  if (argc > 1) { expect( chdir(argv[1]) == 0 ); }
+  parse_args(argc, argv);
+
+  if (render.headless) {
+    SDL_Init(SDL_INIT_TIMER);
+    app.fe_lock = SDL_CreateMutex();
+    int bytes = 1024 * 256;
+    app.fe_ctx = fe_open(malloc(bytes), bytes);
+    extern fex_Reg api_core []; fex_register_funcs(app.fe_ctx, api_core );
+    extern fex_Reg api_dsp  []; fex_register_funcs(app.fe_ctx, api_dsp  );
+    dsp_init(&dsp_config, tick_callback, dsp_error_callback);
+    app_fe_push();
+    app_do_file(render.script);
+    app_fe_pop();
+    return;
+  }
 
   SDL_Init(SDL_INIT_EVERYTHING);
 #if _WIN32
@@ -79,12 +189,13 @@ void app_init(int argc, char **argv) {
   extern fex_Reg api_dsp  []; fex_register_funcs(app.fe_ctx, api_dsp  );
 
   /* init dsp and midi */
-  dsp_init(tick_callback);
+  dsp_init(&dsp_config, tick_callback, dsp_error_callback);
+  dsp_open_device();
   midi_init(midi_callback);
 
   /* init scripts */
   app_fe_push();
-  app_do_file("main.fe");
+  app_do_file(render.script);
   app_fe_pop();
 }
 
@@ -174,9 +285,50 @@ static void process_frame(mu_Context *ctx) {
 }
 
 
+static void run_render(void) {
+  static float buf[RENDER_FRAMES * NODE_MAX_CHANNELS];
+  uint64_t total = render.seconds * NODE_SAMPLERATE;
+  uint64_t start = SDL_GetPerformanceCounter();
+
+  for (uint64_t done = 0; done < total; done += RENDER_FRAMES) {
+    int n = mu_min(total - done, RENDER_FRAMES);
+    /* there is no sequencer thread when rendering; ticks are run here */
+    dsp_sequence(n);
+    dsp_render(buf, n);
+    if (wav_write(&render.wav, buf, n)) {
+      fprintf(stderr, "error: failed writing output\n");
+      exit(EXIT_FAILURE);
+    }
+    app_fe_push();
+    dsp_update();
+    app_fe_pop();
+  }
+
+  if (wav_close(&render.wav)) {
+    fprintf(stderr, "error: failed writing output\n");
+    exit(EXIT_FAILURE);
+  }
+
+  double elapsed = (double) (SDL_GetPerformanceCounter() - start) /
+    SDL_GetPerformanceFrequency();
+  printf("rendered %.1fs of audio in %.2fs (%.1fx realtime)\n",
+    render.seconds, elapsed, render.seconds / mu_max(elapsed, 1e-6));
+}
+
+
 void app_run(void) {
+  if (render.headless) {
+    run_render();
+    return;
+  }
+
   /* main loop */
   for (;;) {
+    /* free destroyed nodes and report errors from the audio thread */
+    app_fe_push();
+    dsp_update();
+    app_fe_pop();
+
     ui_begin_frame(app.mu_ctx);
     process_frame(app.mu_ctx);
     ui_end_frame(app.mu_ctx);
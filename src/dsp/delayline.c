@@ -0,0 +1,60 @@
+#include "delayline.h"
+
+
+static int line_length(float maxtime) {
+  /* room for the furthest cubic read past `maxtime` */
+  int len = 4;
+  while (len < maxtime * NODE_SAMPLERATE + 4) { len *= 2; }
+  return len;
+}
+
+
+size_t delayline_size(float maxtime) {
+  return sizeof(DelayLine) + line_length(maxtime) * sizeof(float);
+}
+
+
+/* `mem` is zeroed, as from the node pool or `node_alloc_memory()` */
+DelayLine* delayline_init(void *mem, float maxtime) {
+  DelayLine *line = mem;
+  line->maxtime = maxtime;
+  line->mask = line_length(maxtime) - 1;
+  return line;
+}
+
+
+/* runs on the sending thread: a new maxtime gets its line allocated there */
+void* delayline_prepare(const char *msg) {
+  float val;
+  if (sscanf(msg, "maxtime %f", &val) == 1 && val > 0 && val <= DELAYLINE_MAX_MAXTIME) {
+    return delayline_init(node_alloc_memory(delayline_size(val)), val);
+  }
+  return NULL;
+}
+
+
+/* swaps in the prepared line, returning the old one for freeing unless it
+** is the node's pooled line */
+void* delayline_adopt(DelayLine **line, DelayLine *pooled, void *mem) {
+  DelayLine *old = *line;
+  *line = mem;
+  return old == pooled ? NULL : old;
+}
+
+
+/* the line itself was made by `delayline_prepare()` and taken by
+** `delayline_adopt()`, so a maxtime which doesn't match was refused there */
+int delayline_receive_maxtime(DelayLine *line, const char *msg, char *err) {
+  float val = 0;
+  sscanf(msg, "maxtime %f", &val);
+  if (line->maxtime != val) {
+    sprintf(err, "maxtime should be above 0 and at most %g", DELAYLINE_MAX_MAXTIME);
+    return -1;
+  }
+  return 0;
+}
+
+
+void delayline_free(DelayLine *line, DelayLine *pooled) {
+  if (line != pooled) { free(line); }
+}
@@ -0,0 +1,46 @@
+#ifndef DELAYLINE_H
+#define DELAYLINE_H
+
+#include "node.h"
+
+#define DELAYLINE_DEFAULT_MAXTIME 1.0
+#define DELAYLINE_MAX_MAXTIME     600.0
+
+/* ring buffer shared by the nodes built around a delay line. Its length is
+** a power of two at least `maxtime` long, so reads wrap with a mask. A
+** node's default line is allocated right after the node, so it is pooled
+** along with it; lines for other maxtimes are made by `delayline_prepare()`
+** on the sending thread and swapped in by `delayline_adopt()` */
+typedef struct {
+  float maxtime;
+  int mask;
+  int idx;   /* where the next sample is written */
+  int quiet; /* samples written since the last audible one */
+  float buf[];
+} DelayLine;
+
+size_t delayline_size(float maxtime);
+DelayLine* delayline_init(void *mem, float maxtime);
+void* delayline_prepare(const char *msg);
+void* delayline_adopt(DelayLine **line, DelayLine *pooled, void *mem);
+int delayline_receive_maxtime(DelayLine *line, const char *msg, char *err);
+void delayline_free(DelayLine *line, DelayLine *pooled);
+
+
+static inline void delayline_write(DelayLine *line, float x) {
+  line->buf[line->idx] = x + NODE_DENORMAL_OFFSET;
+  line->idx = (line->idx + 1) & line->mask;
+  if (fabs(x) >= NODE_SILENCE) {
+    line->quiet = 0;
+  } else if (line->quiet <= line->mask) {
+    line->quiet++;
+  }
+}
+
+
+/* everything in the line has decayed */
+static inline bool delayline_silent(DelayLine *line) {
+  return line->quiet > line->mask;
+}
+
+#endif
@@ -1,21 +1,121 @@
 #include <SDL2/SDL.h>
+#include <float.h>
 #include "common.h"
+#include "queue.h"
+#include "pool.h"
+#include "stream.h"
 #include "dsp.h"
 
-#define MAX_NODES 10000
+#define HANDLE_BITS  16
+#define MAX_NODES    (1 << HANDLE_BITS)
+#define MAX_GENERATION 255
+#define MAX_COMMANDS 1024
+#define MAX_EVENTS   1024
+#define MAX_TYPES    32
+#define MAX_OBSERVED 256
+#define OBSERVE_TIMEOUT 1000
+#define STATS_WINDOW (NODE_SAMPLERATE / NODE_BUFFER_SIZE)
 
-static Node *nodes[MAX_NODES];
-static int max_node;
+enum {
+  CMD_ADD, CMD_DESTROY, CMD_LINK, CMD_UNLINK, CMD_SET, CMD_SEND, CMD_THREADS,
+  CMD_PROFILE, CMD_OBSERVE, CMD_RAMP
+};
+
+typedef struct {
+  int type;
+  Node *node, *node2;
+  int idx, idx2;
+  float value;
+  uint64_t time; /* frame to apply the command at, or 0 for right away */
+  char msg[NODE_MAX_MESSAGE];
+  void *mem; /* from the node's `prepare`, for `adopt` */
+} Command;
+
+typedef struct {
+  Node *node; /* node to be freed, or NULL */
+  void *mem;  /* list of memory blocks to be freed, or NULL */
+  char err[NODE_MAX_ERROR + 32]; /* node's error prefixed with its name */
+} Reply;
 
-static FILE *stream_fp;
-static SDL_mutex *stream_lock;
+/* owned by the thread making changes to the graph. Nodes are referred to
+** by handles holding a slot index and the slot's generation, which changes
+** each time the slot is reused so that stale handles can be rejected. Both
+** fit in the 24 bit integer range of fe's float numbers */
+typedef struct { Node *node; int gen, next_free; } Slot;
+static Slot *slots;
+static int slot_count, slot_capacity;
+static int free_list = -1;
+static struct { Node *node; uint32_t time; } observed[MAX_OBSERVED];
+static int observed_count;
+
+/* owned by the audio thread */
+static Node *live[MAX_NODES];
+static int live_count;
+static Node *sinks[MAX_NODES];
+static int sink_count;
+static Node *watched[MAX_OBSERVED]; /* observed nodes */
+static int watched_count;
+static Node *plan[MAX_NODES];
+static int plan_count;
+static bool plan_dirty;
+static int plan_epoch; /* marks below it are from older plans */
+static Node *plan_roots[MAX_NODES];
+static Node *plan_levels[MAX_NODES];
+static int plan_level_start[MAX_NODES + 1];
+static PoolPlan pool_plan = {
+  .nodes = plan, .roots = plan_roots,
+  .levels = plan_levels, .level_start = plan_level_start
+};
+static int threads = 1;
+static bool deterministic;
+static uint64_t frame_clock; /* frames rendered so far */
+
+/* commands timestamped for later wait in a heap ordered by time, then by
+** arrival; the commands themselves stay put in `event_cmds` */
+typedef struct { uint64_t time, seq; int slot; } Event;
+static Event events[MAX_EVENTS];
+static int event_count;
+static uint64_t event_seq;
+static Command event_cmds[MAX_EVENTS];
+static int event_free[MAX_EVENTS];
+static int event_free_count;
+
+/* graph changes are sent to the audio thread as commands, and destroyed
+** nodes and errors come back as replies */
+static Queue commands;
+static Queue replies;
 
 static DspTickFn tick_callback;
+static DspErrorFn error_callback;
 static double tick_interval = 0.125;
-static double tick_timer;
+static double tick_next; /* frame the next tick falls on */
+static int lookahead;    /* frames ticks are run ahead of the audio clock */
+
+/* the audio clock as last published to other threads, and the frame of the
+** tick being run, which is the time commands are scheduled relative to
+** from within the tick callback */
+static _Atomic uint64_t clock_shared;
+static _Thread_local bool ticking;
+static uint64_t tick_frame;
 
-static SDL_mutex *lock;
 static SDL_AudioDeviceID dev;
+static int device_frames;
+static int channels;
+static Stream *recording;
+
+/* profiling: nodes are timed on the audio thread, which publishes a summary
+** for the main thread about once a second */
+static bool profiling;
+static double ns_per_tick;
+static int stats_blocks;
+static double stats_load_total, stats_load_max; /* nanoseconds */
+static SDL_mutex *stats_lock;
+static struct {
+  double load, max_load;
+  Node *owners[MAX_NODES];
+  DspStat nodes[MAX_NODES]; int node_count;
+  DspStat types[MAX_TYPES]; int type_count;
+} stats_shared;
 
 
 Node* new_dac_node(void);
@@ -26,135 +126,991 @@ Node* new_line_node(void);
 Node* new_shaper_node(void);
 Node* new_delay_node(void);
 Node* new_reverb_node(void);
+Node* new_tap_node(void);
+Node* new_file_node(void);
+Node* new_multitap_node(void);
 
 static struct { const char *name; NodeConstructor fn; } node_table[] = {
-  { "dac",    new_dac_node    },
-  { "osc",    new_osc_node    },
-  { "svf",    new_svf_node    },
-  { "math",   new_math_node   },
-  { "line",   new_line_node   },
-  { "shaper", new_shaper_node },
-  { "reverb", new_reverb_node },
-  { "delay",  new_delay_node  },
+  { "dac",      new_dac_node      },
+  { "osc",      new_osc_node      },
+  { "svf",      new_svf_node      },
+  { "math",     new_math_node     },
+  { "line",     new_line_node     },
+  { "shaper",   new_shaper_node   },
+  { "reverb",   new_reverb_node   },
+  { "delay",    new_delay_node    },
+  { "tap",      new_tap_node      },
+  { "file",     new_file_node     },
+  { "multitap", new_multitap_node },
   { },
 };
 
 
-static int next_free_id(void) {
-  for (int i = 0; i < MAX_NODES; i++) {
-    if (nodes[i] == NULL) {
-      if (i > max_node) { max_node = i; }
-      return i;
+static int alloc_slot(void) {
+  if (free_list >= 0) {
+    int idx = free_list;
+    free_list = slots[idx].next_free;
+    return idx;
+  }
+  if (slot_count == MAX_NODES) { return -1; }
+  if (slot_count == slot_capacity) {
+    slot_capacity = slot_capacity ? slot_capacity * 2 : 256;
+    slots = realloc(slots, sizeof(Slot) * slot_capacity);
+    expect(slots);
+  }
+  slots[slot_count] = (Slot) { .gen = 1 };
+  return slot_count++;
+}
+
+
+static void release_slot(int idx) {
+  Slot *slot = &slots[idx];
+  slot->node = NULL;
+  slot->gen = slot->gen % MAX_GENERATION + 1;
+  slot->next_free = free_list;
+  free_list = idx;
+}
+
+
+static void drain_commands(void);
+static uint64_t frame_at(double delay);
+
+/* the queue is only full while the audio thread is behind, and this is
+** never the audio thread, so the caller waits for room. Replies are taken
+** meanwhile, as the audio thread stops draining when it has no room for
+** them. With no device open nothing else drains the queue, as when a
+** script loads before an offline render, so commands are applied here.
+** Scripts call in with the fe lock held, which stays held while waiting:
+** a full queue holds up whichever of the main and sequencer threads is
+** sending, and the other one until it gets the lock, for as long as the
+** audio thread needs to catch up. Commands sent from the tick callback all carry the tick's frame, so that
+** graph changes land on it along with the sets and sends made next to them */
+static int push_command(Command *cmd) {
+  if (!cmd->time) { cmd->time = frame_at(0); }
+  while (!queue_push(&commands, cmd)) {
+    dsp_update();
+    if (dev) {
+      SDL_Delay(1);
+    } else {
+      drain_commands();
     }
   }
-  panic("exhausted nodes array");
-  return 0; /* never reached */
+  return NODE_ESUCCESS;
 }
 
 
-int dsp_new_node(const char *name) {
+static NodeConstructor find_constructor(const char *name) {
   for (int i = 0; node_table[i].name; i++) {
-    if (strcmp(node_table[i].name, name) == 0) {
-      Node *node = node_table[i].fn();
-      SDL_LockMutex(lock);
-      int id = next_free_id();
-      nodes[id] = node;
-      SDL_UnlockMutex(lock);
-      return id;
-    }
+    if (strcmp(node_table[i].name, name) == 0) { return node_table[i].fn; }
   }
-  return -1;
+  return NULL;
+}
+
+
+int dsp_new_node(const char *name) {
+  NodeConstructor fn = find_constructor(name);
+  if (!fn) { return NODE_EBADNAME; }
+  int idx = alloc_slot();
+  if (idx < 0) { return NODE_EMAXNODES; }
+  Node *node = fn();
+  slots[idx].node = node;
+  node->id = (slots[idx].gen << HANDLE_BITS) | idx;
+  push_command(&(Command) { .type = CMD_ADD, .node = node });
+  return node->id;
+}
+
+
+int dsp_reserve(const char *name, int count) {
+  NodeConstructor fn = find_constructor(name);
+  if (!fn) { return NODE_EBADNAME; }
+
+  /* construct a node so the type's pool knows its node size */
+  Node *node = fn();
+  NodeInfo *info = node->info;
+  node->vtable->free(node);
+  node_reserve(info, count);
+  return NODE_ESUCCESS;
 }
 
 
 int dsp_destroy_node(int id) {
   Node *node = dsp_get_node(id);
-  if (!node) { return -1; }
-  SDL_LockMutex(lock);
-  nodes[id] = NULL;
-  node->vtable->free(node);
-  SDL_UnlockMutex(lock);
-  return 0;
+  if (!node) { return NODE_EBADNODE; }
+  int err = push_command(&(Command) { .type = CMD_DESTROY, .node = node });
+  if (err) { return err; }
+  release_slot(id & (MAX_NODES - 1));
+  for (int i = 0; i < observed_count; i++) {
+    if (observed[i].node == node) { observed[i] = observed[--observed_count]; break; }
+  }
+  return NODE_ESUCCESS;
+}
+
+
+/* nodes are only processed if they feed a sink or if the script has read
+** from them recently, in which case they are kept alive for a while */
+void dsp_observe(Node *node) {
+  uint32_t now = SDL_GetTicks();
+  for (int i = 0; i < observed_count; i++) {
+    if (observed[i].node == node) { observed[i].time = now; return; }
+  }
+  if (observed_count == MAX_OBSERVED) { return; }
+  push_command(&(Command) { .type = CMD_OBSERVE, .node = node, .idx = 1 });
+  observed[observed_count].node = node;
+  observed[observed_count].time = now;
+  observed_count++;
+}
+
+
+static void expire_observed(void) {
+  uint32_t now = SDL_GetTicks();
+  for (int i = observed_count - 1; i >= 0; i--) {
+    if (now - observed[i].time < OBSERVE_TIMEOUT) { continue; }
+    /* called while waiting on a full queue, so this tries again later
+    ** rather than waiting itself */
+    Command cmd = {
+      .type = CMD_OBSERVE, .node = observed[i].node, .idx = 0, .time = frame_at(0)
+    };
+    if (!queue_push(&commands, &cmd)) { return; }
+    observed[i] = observed[--observed_count];
+  }
 }
 
 
 Node* dsp_get_node(int id) {
-  if (id < 0 || id > max_node) { return NULL; }
-  return nodes[id];
+  if (id < 0) { return NULL; }
+  int idx = id & (MAX_NODES - 1);
+  if (idx >= slot_count || slots[idx].gen != id >> HANDLE_BITS) { return NULL; }
+  return slots[idx].node;
 }
 
 
-void process_nodes(float *buf) {
-  /* process all nodes */
-  for (int i = 0; i <= max_node; i++) {
-    if (!nodes[i]) { continue; }
-    nodes[i]->vtable->process(nodes[i]);
+static int push_link_command(int type, Node *from, const char *outlet, Node *to, const char *inlet) {
+  int idx1 = string_to_enum(from->info->outlets, outlet);
+  int idx2 = string_to_enum(  to->info->inlets,  inlet );
+  if (idx1 < 0) { return NODE_EBADOUTLET; }
+  if (idx2 < 0) { return NODE_EBADINLET;  }
+  return push_command(&(Command) {
+    .type = type, .node = from, .idx = idx1, .node2 = to, .idx2 = idx2
+  });
+}
+
+
+int dsp_link(Node *from, const char *outlet, Node *to, const char *inlet) {
+  return push_link_command(CMD_LINK, from, outlet, to, inlet);
+}
+
+
+int dsp_unlink(Node *from, const char *outlet, Node *to, const char *inlet) {
+  return push_link_command(CMD_UNLINK, from, outlet, to, inlet);
+}
+
+
+double dsp_time(void) {
+  uint64_t frame = ticking ? tick_frame : atomic_load(&clock_shared);
+  return (double) frame / NODE_SAMPLERATE;
+}
+
+
+/* commands sent from the tick callback are timed from the tick, so those
+** without a delay land exactly on it; others are timed from the last block
+** rendered, and without a delay are applied as soon as possible */
+static uint64_t frame_at(double delay) {
+  delay = delay > 0 ? delay : 0;
+  if (ticking) { return tick_frame + llround(delay * NODE_SAMPLERATE); }
+  if (delay == 0) { return 0; }
+  return atomic_load(&clock_shared) + llround(delay * NODE_SAMPLERATE);
+}
+
+
+int dsp_set(Node *node, const char *inlet, float value) {
+  return dsp_set_at(node, inlet, value, 0);
+}
+
+
+int dsp_set_at(Node *node, const char *inlet, float value, double delay) {
+  int idx = string_to_enum(node->info->inlets, inlet);
+  if (idx < 0) { return NODE_EBADINLET; }
+  uint64_t time = frame_at(delay);
+
+  /* values wanted right away skip the queue: the inlet's target is set
+  ** directly, and the audio thread picks it up at the start of a block */
+  if (time == 0) {
+    atomic_store(&node->inlets[idx].target, value);
+    return NODE_ESUCCESS;
+  }
+  return push_command(&(Command) {
+    .type = CMD_SET, .node = node, .idx = idx, .value = value, .time = time
+  });
+}
+
+
+int dsp_ramp(Node *node, const char *inlet, float time, bool exponential) {
+  int idx = string_to_enum(node->info->inlets, inlet);
+  if (idx < 0) { return NODE_EBADINLET; }
+  return push_command(&(Command) {
+    .type = CMD_RAMP, .node = node, .idx = idx, .value = time, .idx2 = exponential
+  });
+}
+
+
+int dsp_send(Node *node, const char *msg) {
+  return dsp_send_at(node, msg, 0);
+}
+
+
+int dsp_send_at(Node *node, const char *msg, double delay) {
+  Command cmd = { .type = CMD_SEND, .node = node, .time = frame_at(delay) };
+  snprintf(cmd.msg, sizeof(cmd.msg), "%s", msg);
+  if (node->vtable->prepare) { cmd.mem = node->vtable->prepare(node, msg); }
+  int err = push_command(&cmd);
+  if (err) { free(cmd.mem); }
+  return err;
+}
+
+
+int dsp_set_threads(int n, bool deterministic) {
+  n = n < 1 ? 1 : n > POOL_MAX_THREADS ? POOL_MAX_THREADS : n;
+  pool_spawn(n);
+  return push_command(&(Command) {
+    .type = CMD_THREADS, .idx = n, .idx2 = deterministic
+  });
+}
+
+
+int dsp_set_profile(bool enabled) {
+  return push_command(&(Command) { .type = CMD_PROFILE, .idx = enabled });
+}
+
+
+static void forget_stats(Node *node) {
+  SDL_LockMutex(stats_lock);
+  for (int i = 0; i < stats_shared.node_count; i++) {
+    if (stats_shared.owners[i] == node) { stats_shared.owners[i] = NULL; }
+  }
+  SDL_UnlockMutex(stats_lock);
+}
+
+
+const DspStats* dsp_get_stats(void) {
+  static DspStat node_stats[MAX_NODES];
+  static DspStat type_stats[MAX_TYPES];
+  static DspStats res = { .nodes = node_stats, .types = type_stats };
+
+  SDL_LockMutex(stats_lock);
+  res.load = stats_shared.load;
+  res.max_load = stats_shared.max_load;
+  res.stream_dropped = stream_dropped(recording);
+  res.node_count = 0;
+  for (int i = 0; i < stats_shared.node_count; i++) {
+    /* skip nodes which were destroyed since the stats were published */
+    Node *node = stats_shared.owners[i];
+    if (node && dsp_get_node(node->id) == node) {
+      node_stats[res.node_count++] = stats_shared.nodes[i];
+    }
+  }
+  memcpy(type_stats, stats_shared.types, sizeof(DspStat) * stats_shared.type_count);
+  res.type_count = stats_shared.type_count;
+  SDL_UnlockMutex(stats_lock);
+
+  return &res;
+}
+
+
+void dsp_update(void) {
+  Reply rep;
+  expire_observed();
+  while (queue_pop(&replies, &rep)) {
+    while (rep.mem) {
+      void *next = *(void**) rep.mem;
+      free(rep.mem);
+      rep.mem = next;
+    }
+    if (rep.node) {
+      forget_stats(rep.node);
+      rep.node->vtable->free(rep.node);
+    }
+    if (*rep.err && error_callback) { error_callback(rep.err); }
+  }
+}
+
+
+static bool event_before(Event *a, Event *b) {
+  return a->time < b->time || (a->time == b->time && a->seq < b->seq);
+}
+
+
+static void sift_down(int i) {
+  for (;;) {
+    int l = i * 2 + 1, r = l + 1, min = i;
+    if (l < event_count && event_before(&events[l], &events[min])) { min = l; }
+    if (r < event_count && event_before(&events[r], &events[min])) { min = r; }
+    if (min == i) { return; }
+    Event tmp = events[i]; events[i] = events[min]; events[min] = tmp;
+    i = min;
+  }
+}
+
+
+static bool schedule_event(Command *cmd) {
+  if (event_count == MAX_EVENTS) { return false; }
+  int slot = event_free[--event_free_count];
+  event_cmds[slot] = *cmd;
+
+  /* sift up */
+  int i = event_count++;
+  events[i] = (Event) { cmd->time, event_seq++, slot };
+  while (i > 0 && event_before(&events[i], &events[(i - 1) / 2])) {
+    Event tmp = events[i]; events[i] = events[(i - 1) / 2]; events[(i - 1) / 2] = tmp;
+    i = (i - 1) / 2;
+  }
+  return true;
+}
+
+
+static Command* pop_event(void) {
+  int slot = events[0].slot;
+  event_free[event_free_count++] = slot;
+  events[0] = events[--event_count];
+  sift_down(0);
+  return &event_cmds[slot];
+}
+
+
+/* memory to be freed on the main thread is passed back as a list, linked
+** through the first bytes of each block */
+static void* mem_push(void *list, void *mem) {
+  if (!mem) { return list; }
+  *(void**) mem = list;
+  return mem;
+}
+
+
+/* drops the node's pending events, including links made to it, returning
+** the memory they held */
+static void* forget_events(Node *node) {
+  void *mem = NULL;
+  int n = 0;
+  for (int i = 0; i < event_count; i++) {
+    Command *cmd = &event_cmds[events[i].slot];
+    if (cmd->node == node || cmd->node2 == node) {
+      mem = mem_push(mem, cmd->mem);
+      event_free[event_free_count++] = events[i].slot;
+    } else {
+      events[n++] = events[i];
+    }
+  }
+  if (n == event_count) { return mem; }
+  event_count = n;
+  for (int i = n / 2 - 1; i >= 0; i--) { sift_down(i); }
+  return mem;
+}
+
+
+/* whether the node was reached by the last plan compiled. Only a change
+** touching such a node can change which nodes are live; others, such as
+** links within a parked sub-graph, leave the plan as it is */
+static bool in_plan(Node *node) {
+  return node->mark == plan_epoch + 1;
+}
+
+
+static bool is_live(Node *node) {
+  return node->live_idx < live_count && live[node->live_idx] == node;
+}
+
+
+static void set_watched(Node *node, bool observed) {
+  if (node->observed == observed) { return; }
+  node->observed = observed;
+  if (observed) {
+    if (watched_count < MAX_OBSERVED) { watched[watched_count++] = node; }
+    return;
+  }
+  for (int i = 0; i < watched_count; i++) {
+    if (watched[i] == node) { watched[i] = watched[--watched_count]; break; }
+  }
+}
+
+
+static void apply_command(Command *cmd) {
+  Reply rep = { NULL, NULL, "" };
+  char err[NODE_MAX_ERROR] = "";
+
+  switch (cmd->type) {
+    case CMD_ADD:
+      cmd->node->live_idx = live_count;
+      live[live_count++] = cmd->node;
+      if (cmd->node->info->sink) {
+        cmd->node->sink_idx = sink_count;
+        sinks[sink_count++] = cmd->node;
+        plan_dirty = true;
+      }
+      break;
+
+    case CMD_DESTROY:
+      if (in_plan(cmd->node)) { plan_dirty = true; }
+      set_watched(cmd->node, false);
+      node_deinit(cmd->node);
+      rep.mem = forget_events(cmd->node);
+      rep.node = cmd->node;
+      /* a node made in a tick and destroyed from the main thread may go
+      ** before its add was due, which was dropped along with its events */
+      if (!is_live(cmd->node)) { break; }
+      live[cmd->node->live_idx] = live[--live_count];
+      live[cmd->node->live_idx]->live_idx = cmd->node->live_idx;
+      if (cmd->node->info->sink) {
+        sinks[cmd->node->sink_idx] = sinks[--sink_count];
+        sinks[cmd->node->sink_idx]->sink_idx = cmd->node->sink_idx;
+      }
+      break;
+
+    case CMD_LINK:
+      if (node_link(cmd->node, cmd->idx, cmd->node2, cmd->idx2)) {
+        sprintf(err, "max links exceeded");
+      }
+      if (in_plan(cmd->node2)) { plan_dirty = true; }
+      break;
+
+    case CMD_UNLINK:
+      node_unlink(cmd->node, cmd->idx, cmd->node2, cmd->idx2);
+      if (in_plan(cmd->node2)) { plan_dirty = true; }
+      break;
+
+    case CMD_SET:
+      atomic_store(&cmd->node->inlets[cmd->idx].target, cmd->value);
+      break;
+
+    case CMD_RAMP:
+      cmd->node->inlets[cmd->idx].ramp_time = cmd->value;
+      cmd->node->inlets[cmd->idx].ramp_exp = cmd->idx2;
+      break;
+
+    case CMD_SEND:
+      if (cmd->mem) { rep.mem = mem_push(NULL, cmd->node->vtable->adopt(cmd->node, cmd->mem)); }
+      cmd->node->vtable->receive(cmd->node, cmd->msg, err);
+      break;
+
+    case CMD_THREADS:
+      threads = cmd->idx;
+      deterministic = cmd->idx2;
+      break;
+
+    case CMD_OBSERVE:
+      /* a node already in the plan stays there when observed, one which
+      ** stops being observed may drop out of it */
+      if (cmd->idx != in_plan(cmd->node)) { plan_dirty = true; }
+      set_watched(cmd->node, cmd->idx);
+      break;
+
+    case CMD_PROFILE:
+      profiling = cmd->idx;
+      for (int i = 0; i < live_count; i++) {
+        memset(&live[i]->stats, 0, sizeof(NodeStats));
+      }
+      stats_blocks = 0;
+      stats_load_total = stats_load_max = 0;
+      break;
+  }
+
+  if (*err) {
+    snprintf(rep.err, sizeof(rep.err), "%s: %s", cmd->node->info->name, err);
   }
+  if (rep.node || rep.mem || *rep.err) {
+    queue_push(&replies, &rep);
+  }
+}
 
-  /* reset output buffer */
-  memset(buf, 0, sizeof(float) * NODE_BUFFER_SIZE * 2);
 
-  /* copy dac outlet buffers to provided buffer */
-  for (int i = 0; i <= max_node; i++) {
-    if (!nodes[i]) { continue; }
-    if (strcmp(nodes[i]->info->name, "dac") == 0) {
-      for (int j = 0; j < NODE_BUFFER_SIZE; j++) {
-        buf[j*2+0] += nodes[i]->outlets[0].buf[j];
-        buf[j*2+1] += nodes[i]->outlets[1].buf[j];
+static void drain_commands(void) {
+  Command cmd;
+  /* each command yields at most one reply, so only take a command while
+  ** there is room left for it in the reply queue */
+  while (!queue_full(&replies) && queue_pop(&commands, &cmd)) {
+    if (cmd.time <= frame_clock) {
+      apply_command(&cmd);
+    } else if (!schedule_event(&cmd)) {
+      /* graph changes can't be dropped without leaving the graph in a
+      ** state the main thread doesn't know about, so they go in early */
+      if (cmd.type != CMD_SET && cmd.type != CMD_SEND) {
+        apply_command(&cmd);
+        continue;
       }
+      Reply rep = { NULL, mem_push(NULL, cmd.mem), "" };
+      snprintf(rep.err, sizeof(rep.err), "%s: too many events pending", cmd.node->info->name);
+      queue_push(&replies, &rep);
     }
   }
 }
 
-static void process(float *buf, int len) {
-  static float temp_buf[NODE_BUFFER_SIZE * 2];
-  static int   temp_buf_idx = 0;
-
-  for (int i = 0; i < len; i++) {
-    /* copy from internal buffer to provided buffer */
-    buf[i] = temp_buf[temp_buf_idx++];
-
-    /* refill internal buffer if its been exhaused */
-    if (temp_buf_idx == NODE_BUFFER_SIZE * 2) {
-      SDL_LockMutex(lock);
-      process_nodes(temp_buf);
-      SDL_UnlockMutex(lock);
-      temp_buf_idx = 0;
+
+typedef struct { Node *node; int inlet, link; } PlanFrame;
+
+static void compile_plan(void) {
+  static PlanFrame stack[MAX_NODES];
+  static Node *starts[MAX_NODES];
+  int sp, start_count = 0;
+
+  /* a node is being visited while its mark is the epoch and has been
+  ** visited once it is one past it; moving the epoch on unmarks every node
+  ** without touching those left out of the plan */
+  plan_epoch += 2;
+  const int VISITING = plan_epoch, VISITED = plan_epoch + 1;
+  for (int i = 0; i < sink_count; i++) { starts[start_count++] = sinks[i]; }
+  for (int i = 0; i < watched_count; i++) {
+    if (!watched[i]->info->sink) { starts[start_count++] = watched[i]; }
+  }
+  plan_count = 0;
+
+  /* depth-first search over inlet links, starting from the sinks and the
+  ** observed nodes, so nodes which feed neither are never processed.
+  ** A node is appended to the plan only once everything feeding it has
+  ** been, so its inlets are always complete by the time it is processed.
+  ** A link back to a node that is still being visited closes a cycle; it is
+  ** left as is and its audio arrives one block late, as the node writing it
+  ** runs after the reader */
+  for (int i = 0; i < start_count; i++) {
+    if (starts[i]->mark >= VISITING) { continue; }
+    sp = 0;
+    stack[sp++] = (PlanFrame) { starts[i], 0, 0 };
+    starts[i]->mark = VISITING;
+
+    while (sp > 0) {
+      PlanFrame *top = &stack[sp - 1];
+      Node *node = top->node;
+
+      /* find next link of the node on top of the stack */
+      Node *next = NULL;
+      while (node->info->inlets[top->inlet]) {
+        NodePort *inlet = &node->inlets[top->inlet];
+        if (top->link < inlet->link_count) {
+          next = inlet->links[top->link++].node;
+          break;
+        }
+        top->inlet++;
+        top->link = 0;
+      }
+
+      /* all inputs visited: node can be appended to the plan */
+      if (!next) {
+        node->mark = VISITED;
+        plan[plan_count++] = node;
+        sp--;
+        continue;
+      }
+
+      if (next->mark < VISITING) {
+        next->mark = VISITING;
+        stack[sp++] = (PlanFrame) { next, 0, 0 };
+      }
     }
+  }
 
-    /* handle tick timer */
-    if (temp_buf_idx == 0) {
-      tick_timer -= NODE_SAMPLETIME * NODE_BUFFER_SIZE;
-      while (tick_timer < 0) {
-        if (tick_callback) { tick_callback(); }
-        tick_timer += tick_interval;
+  /* work out what each node waits on when nodes are processed in parallel:
+  ** only links from earlier in the plan count, a node feeding back into an
+  ** earlier one always runs after it as it is downstream of it */
+  /* there are never more levels than nodes in the plan */
+  memset(plan_level_start, 0, sizeof(int) * (plan_count + 1));
+  int root_count = 0, level_count = 0;
+  for (int i = 0; i < plan_count; i++) {
+    plan[i]->order = i;
+  }
+  for (int i = 0; i < plan_count; i++) {
+    Node *node = plan[i];
+    node->deps = 0;
+    node->level = 0;
+    for (int j = 0; node->info->inlets[j]; j++) {
+      NodePort *inlet = &node->inlets[j];
+      for (int k = 0; k < inlet->link_count; k++) {
+        Node *from = inlet->links[k].node;
+        if (from->order >= i) { continue; }
+        node->deps++;
+        if (from->level + 1 > node->level) { node->level = from->level + 1; }
       }
     }
+    if (node->deps == 0) { plan_roots[root_count++] = node; }
+    if (node->level + 1 > level_count) { level_count = node->level + 1; }
+    plan_level_start[node->level + 1]++;
   }
+
+  /* group plan by level, keeping plan order within each level */
+  for (int i = 0; i < level_count; i++) {
+    plan_level_start[i + 1] += plan_level_start[i];
+  }
+  static int fill[MAX_NODES];
+  memcpy(fill, plan_level_start, sizeof(int) * level_count);
+  for (int i = 0; i < plan_count; i++) {
+    plan_levels[fill[plan[i]->level]++] = plan[i];
+  }
+
+  /* no node reads from another in its own level, feedback links included,
+  ** so nodes of the same type can be moved next to each other and run as a
+  ** batch; otherwise the first appearance of each type keeps its place */
+  static Node *level_tmp[MAX_NODES];
+  for (int l = 0; l < level_count; l++) {
+    int start = plan_level_start[l], count = plan_level_start[l + 1] - start;
+    memcpy(level_tmp, plan_levels + start, sizeof(Node*) * count);
+    int placed = 0;
+    for (int i = 0; i < count; i++) {
+      if (!level_tmp[i]) { continue; }
+      NodeVtable *vtable = level_tmp[i]->vtable;
+      for (int j = i; j < count; j++) {
+        if (level_tmp[j] && level_tmp[j]->vtable == vtable) {
+          plan_levels[start + placed++] = level_tmp[j];
+          level_tmp[j] = NULL;
+        }
+      }
+    }
+  }
+
+  pool_plan.count = plan_count;
+  pool_plan.root_count = root_count;
+  pool_plan.level_count = level_count;
+  pool_plan.mark = VISITED;
+  plan_dirty = false;
+}
+
+
+/* histogram buckets are spaced a quarter octave apart */
+static int stats_bucket(uint64_t ns) {
+  if (ns < 4) { return ns; }
+  int octave = 63 - __builtin_clzll(ns);
+  int b = octave * 4 + ((ns >> (octave - 2)) & 3) - 4;
+  return b < NODE_STATS_BUCKETS ? b : NODE_STATS_BUCKETS - 1;
+}
+
+
+static double stats_bucket_ns(int b) {
+  if (b < 4) { return b; }
+  return (double) (4 + b % 4) * (1ull << (b / 4 - 1));
+}
+
+
+static double stats_percentile(int *hist, uint64_t count, double p) {
+  uint64_t n = 0;
+  for (int i = 0; i < NODE_STATS_BUCKETS; i++) {
+    n += hist[i];
+    /* report the upper edge of the bucket the percentile falls in */
+    if (n >= count * p) { return stats_bucket_ns(i + 1); }
+  }
+  return stats_bucket_ns(NODE_STATS_BUCKETS);
+}
+
+
+static void add_stats(NodeStats *s, double ns) {
+  s->blocks++;
+  s->total += ns;
+  if (ns > s->max) { s->max = ns; }
+  s->hist[stats_bucket(ns)]++;
+}
+
+
+static void publish_stats(void) {
+  static int type_hist[MAX_TYPES][NODE_STATS_BUCKETS];
+  static uint64_t type_blocks[MAX_TYPES];
+
+  /* never wait on the main thread; try again next block instead */
+  if (SDL_TryLockMutex(stats_lock) != 0) { return; }
+
+  double budget = NODE_SAMPLETIME * NODE_BUFFER_SIZE * 1e9;
+  stats_shared.load = stats_load_total / stats_blocks / budget * 100;
+  stats_shared.max_load = stats_load_max / budget * 100;
+  stats_shared.node_count = 0;
+  stats_shared.type_count = 0;
+
+  for (int i = 0; i < live_count; i++) {
+    Node *node = live[i];
+    NodeStats *s = &node->stats;
+    if (s->blocks == 0) { continue; }
+
+    int n = stats_shared.node_count++;
+    DspStat *st = &stats_shared.nodes[n];
+    stats_shared.owners[n] = node;
+    *st = (DspStat) {
+      .name = node->info->name, .id = node->id, .count = 1,
+      .avg = s->total / s->blocks * 1e-3, .max = s->max * 1e-3,
+      .p50 = stats_percentile(s->hist, s->blocks, 0.50) * 1e-3,
+      .p99 = stats_percentile(s->hist, s->blocks, 0.99) * 1e-3,
+    };
+
+    /* accumulate per-type totals */
+    int t = 0;
+    while (t < stats_shared.type_count && stats_shared.types[t].name != st->name) {
+      t++;
+    }
+    if (t < MAX_TYPES) {
+      DspStat *ty = &stats_shared.types[t];
+      if (t == stats_shared.type_count) {
+        stats_shared.type_count++;
+        *ty = (DspStat) { .name = st->name, .id = -1 };
+        memset(type_hist[t], 0, sizeof(type_hist[t]));
+        type_blocks[t] = 0;
+      }
+      ty->count++;
+      ty->avg += st->avg;
+      if (st->max > ty->max) { ty->max = st->max; }
+      for (int j = 0; j < NODE_STATS_BUCKETS; j++) {
+        type_hist[t][j] += s->hist[j];
+      }
+      type_blocks[t] += s->blocks;
+    }
+
+    memset(s, 0, sizeof(*s));
+  }
+
+  for (int t = 0; t < stats_shared.type_count; t++) {
+    DspStat *ty = &stats_shared.types[t];
+    ty->p50 = stats_percentile(type_hist[t], type_blocks[t], 0.50) * 1e-3;
+    ty->p99 = stats_percentile(type_hist[t], type_blocks[t], 0.99) * 1e-3;
+  }
+
+  SDL_UnlockMutex(stats_lock);
+  stats_blocks = 0;
+  stats_load_total = stats_load_max = 0;
+}
+
+
+static void prepare_node(Node *node, int len) {
+  node_pull(node, len);
+  /* outlets are only constant for this block if the node says so */
+  for (int i = 0; node->info->outlets[i]; i++) {
+    node->outlets[i].constant = false;
+  }
+}
+
+
+static void process_node(Node *node, int len) {
+  prepare_node(node, len);
+  if (profiling) {
+    uint64_t start = SDL_GetPerformanceCounter();
+    node->vtable->process(node, len);
+    add_stats(&node->stats, (SDL_GetPerformanceCounter() - start) * ns_per_tick);
+  } else {
+    node->vtable->process(node, len);
+  }
+  atomic_store_explicit(&node->frames, len, memory_order_relaxed);
+}
+
+
+/* processes the leading nodes of `nodes` which share a type in one call if
+** the type can batch them, returns the number processed. `nodes` is a stretch
+** of one level of the plan, in which same-typed nodes are adjacent */
+static int process_run(Node **nodes, int max, int len) {
+  NodeVtable *vtable = nodes[0]->vtable;
+  int count = 1;
+  while (count < max && nodes[count]->vtable == vtable) { count++; }
+
+  if (count == 1 || !vtable->process_batch) {
+    for (int i = 0; i < count; i++) { process_node(nodes[i], len); }
+    return count;
+  }
+
+  for (int i = 0; i < count; i++) { prepare_node(nodes[i], len); }
+  if (profiling) {
+    uint64_t start = SDL_GetPerformanceCounter();
+    vtable->process_batch(nodes, count, len);
+    double ns = (SDL_GetPerformanceCounter() - start) * ns_per_tick / count;
+    for (int i = 0; i < count; i++) { add_stats(&nodes[i]->stats, ns); }
+  } else {
+    vtable->process_batch(nodes, count, len);
+  }
+  for (int i = 0; i < count; i++) {
+    atomic_store_explicit(&nodes[i]->frames, len, memory_order_relaxed);
+  }
+  return count;
+}
+
+
+/* runs the graph for `len` frames, which is less than a block when the
+** block is split by an event */
+static void process_nodes(float *buf, int len) {
+  if (plan_dirty) { compile_plan(); }
+
+  /* process all nodes */
+  if (threads > 1) {
+    pool_process(&pool_plan, len, threads, deterministic);
+  } else {
+    for (int i = 0; i < plan_count;) {
+      int end = plan_level_start[plan_levels[i]->level + 1];
+      i += process_run(&plan_levels[i], end - i, len);
+    }
+  }
+
+  /* sinks write straight into the output buffer; channels none of them
+  ** wrote to are silent */
+  uint32_t written = 0;
+  for (int i = 0; i < sink_count; i++) {
+    Node *node = sinks[i];
+    if (node->vtable->output) { node->vtable->output(node, buf, len, channels, &written); }
+  }
+  for (int ch = 0; ch < channels; ch++) {
+    if (written & (1u << ch)) { continue; }
+    for (int j = 0; j < len; j++) { buf[j * channels + ch] = 0; }
+  }
+}
+
+
+static void process_block(float *buf) {
+  uint64_t start = SDL_GetPerformanceCounter();
+  int size = NODE_BUFFER_SIZE;
+  drain_commands();
+
+  /* events due inside the block split it; the graph is run up to each one
+  ** as a shorter block, so the change lands on its exact frame */
+  for (int pos = 0; pos < size;) {
+    int end = size;
+    while (event_count > 0) {
+      uint64_t t = events[0].time;
+      if (t > frame_clock + pos) {
+        if (t < frame_clock + size) { end = t - frame_clock; }
+        break;
+      }
+      /* as when draining commands, an event is only applied while there is
+      ** room for its reply; otherwise it waits for the next block */
+      if (queue_full(&replies)) { break; }
+      apply_command(pop_event());
+    }
+    process_nodes(buf + pos * channels, end - pos);
+    pos = end;
+  }
+  frame_clock += size;
+  atomic_store(&clock_shared, frame_clock);
+
+  /* update overall load */
+  if (profiling) {
+    double ns = (SDL_GetPerformanceCounter() - start) * ns_per_tick;
+    stats_load_total += ns;
+    if (ns > stats_load_max) { stats_load_max = ns; }
+    if (++stats_blocks >= STATS_WINDOW) { publish_stats(); }
+  }
+}
+
+
+static void process(float *buf, int len) {
+  /* the rest of a block which didn't fit in the previous buffer */
+  static float carry_buf[NODE_MAX_BUFFER_SIZE * NODE_MAX_CHANNELS];
+  static int   carry_len = 0;
+  int block = NODE_BUFFER_SIZE * channels;
+
+  int n = len < carry_len ? len : carry_len;
+  memcpy(buf, carry_buf + block - carry_len, sizeof(float) * n);
+  carry_len -= n;
+  buf += n;
+  len -= n;
+
+  /* whole blocks are rendered straight into the provided buffer */
+  for (; len >= block; buf += block, len -= block) {
+    process_block(buf);
+  }
+
+  if (len > 0) {
+    process_block(carry_buf);
+    memcpy(buf, carry_buf, sizeof(float) * len);
+    carry_len = block - len;
+  }
+}
+
+
+/* runs the ticks falling before the frame `until`. Ticks are run ahead of
+** the audio clock, never on the audio thread, and the commands they send
+** are timed from the tick's frame so they still land on it */
+static void run_ticks(uint64_t until) {
+  ticking = true;
+  while (tick_next < until) {
+    tick_frame = ceil(tick_next);
+    if (tick_callback) { tick_callback(); }
+    tick_next += tick_interval * NODE_SAMPLERATE;
+  }
+  ticking = false;
+}
+
+
+static int sequencer_thread(void *udata) {
+  for (;;) {
+    run_ticks(atomic_load(&clock_shared) + lookahead);
+    SDL_Delay(1);
+  }
+  return 0;
+}
+
+
+void dsp_sequence(int frames) {
+  /* rendering `frames` frames may run the clock up to a block past them */
+  run_ticks(atomic_load(&clock_shared) + frames + NODE_BUFFER_SIZE);
+}
+
+
+void dsp_render(float *buf, int frames) {
+  /* may be called from the main thread when rendering offline, whose own
+  ** floating point state is left as it was */
+  unsigned fp = node_flush_denormals();
+  process(buf, frames * channels);
+  node_restore_denormals(fp);
+  stream_write(recording, buf, frames);
 }
 
 
 static void audio_callback(void *udata, uint8_t *buf, int len) {
-  process((float*) buf, len / sizeof(float));
-  SDL_LockMutex(stream_lock);
-  if (stream_fp) { fwrite(buf, len, 1, stream_fp); }
-  SDL_UnlockMutex(stream_lock);
+  dsp_render((float*) buf, len / (sizeof(float) * channels));
 }
 
 
-void dsp_init(DspTickFn tickfn) {
+/* checks flushing took effect; where it can't, nodes fall back to keeping
+** their state clear of denormals with a tiny offset */
+static bool denormals_flushed(void) {
+  unsigned fp = node_flush_denormals();
+  volatile float tiny = FLT_MIN;
+  bool flushed = tiny * 0.5f == 0;
+  node_restore_denormals(fp);
+  return flushed;
+}
+
+
+void dsp_init(const DspConfig *cfg, DspTickFn tickfn, DspErrorFn errorfn) {
+  node_lock_memory = cfg->lock_memory;
+  node_denormal_offset = denormals_flushed() ? 0 : 1e-18;
+
+  /* block size is kept to a multiple of 16 so node loops vectorize without
+  ** a scalar remainder */
+  if (cfg->samplerate > 0) { node_samplerate = cfg->samplerate; }
+  if (cfg->block_size > 0) {
+    int n = cfg->block_size & ~15;
+    node_buffer_size = n < 16 ? 16 : n > NODE_MAX_BUFFER_SIZE ? NODE_MAX_BUFFER_SIZE : n;
+  }
+  device_frames = cfg->device_frames > 0 ? cfg->device_frames : 1024;
+  /* the audio clock moves a device buffer at a time, the sequencer must
+  ** stay more than that ahead of it */
+  lookahead = device_frames * 2 + NODE_BUFFER_SIZE;
+  channels = cfg->channels > 0 ? cfg->channels : 2;
+  if (channels > NODE_MAX_CHANNELS) { channels = NODE_MAX_CHANNELS; }
+
   tick_callback = tickfn;
-  lock = SDL_CreateMutex();
-  stream_lock = SDL_CreateMutex();
+  error_callback = errorfn;
+  queue_init(&commands, sizeof(Command), MAX_COMMANDS);
+  queue_init(&replies, sizeof(Reply), MAX_COMMANDS);
+  for (int i = 0; i < MAX_EVENTS; i++) { event_free[event_free_count++] = i; }
+  pool_init(process_node, process_run);
+  stream_init();
+  recording = stream_new(channels);
+  stats_lock = SDL_CreateMutex();
+  ns_per_tick = 1e9 / SDL_GetPerformanceFrequency();
+}
+
+
+void dsp_open_device(void) {
   SDL_AudioSpec fmt = {
-    .freq = 44100,
+    .freq = NODE_SAMPLERATE,
     .format = AUDIO_F32,
-    .channels = 2,
-    .samples = 1024,
+    .channels = channels,
+    .samples = device_frames,
     .callback = audio_callback,
   };
   dev = SDL_OpenAudioDevice(NULL, 0, &fmt, NULL, 0);
   expect(dev);
+
+  SDL_Thread *thread = SDL_CreateThread(sequencer_thread, "Sequencer", NULL);
+  expect(thread);
+  SDL_DetachThread(thread);
+
   SDL_PauseAudioDevice(dev, 0);
 }
 
@@ -164,16 +1120,8 @@ void dsp_set_tick(double t) {
 }
 
 
-int dsp_set_stream(const char *filename) {
-  if (stream_fp) {
-    SDL_LockMutex(stream_lock);
-    fclose(stream_fp);
-    stream_fp = NULL;
-    SDL_UnlockMutex(stream_lock);
-  }
-  if (filename) {
-    stream_fp = fopen(filename, "wb");
-    if (!stream_fp) { return -1; }
-  }
-  return 0;
+int dsp_set_stream(const char *filename, int bits) {
+  int err = stream_close(recording);
+  if (filename) { err = stream_open(recording, filename, NODE_SAMPLERATE, bits); }
+  return err;
 }
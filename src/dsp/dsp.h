@@ -3,13 +3,53 @@
 
 #include "node.h"
 
+typedef struct {
+  const char *name; /* node type */
+  int id;           /* node id, or -1 for per-type totals */
+  int count;        /* number of nodes in per-type totals */
+  double avg, max, p50, p99; /* microseconds per block */
+} DspStat;
+
+typedef struct {
+  double load, max_load; /* percentage of the block's time budget */
+  int stream_dropped;    /* frames lost by a recording which fell behind */
+  DspStat *nodes; int node_count;
+  DspStat *types; int type_count;
+} DspStats;
+
+typedef struct {
+  int samplerate;    /* 0 for the defaults */
+  int block_size;    /* frames processed by the nodes at a time */
+  int device_frames; /* frames per audio device callback */
+  int channels;      /* audio device output channels, 2 by default */
+  bool lock_memory;  /* lock node memory into ram */
+} DspConfig;
+
 typedef void (*DspTickFn)(void);
+typedef void (*DspErrorFn)(const char *msg);
 
-void dsp_init(DspTickFn fn);
+void dsp_init(const DspConfig *cfg, DspTickFn tickfn, DspErrorFn errorfn);
+void dsp_open_device(void);
+void dsp_render(float *buf, int frames);
+void dsp_sequence(int frames);
+void dsp_update(void);
 void dsp_set_tick(double t);
-int dsp_set_stream(const char *filename);
+int dsp_set_stream(const char *filename, int bits);
 int dsp_new_node(const char *name);
 int dsp_destroy_node(int id);
+int dsp_reserve(const char *name, int count);
 Node* dsp_get_node(int id);
+void dsp_observe(Node *node);
+int dsp_link(Node *from, const char *outlet, Node *to, const char *inlet);
+int dsp_unlink(Node *from, const char *outlet, Node *to, const char *inlet);
+int dsp_set(Node *node, const char *inlet, float value);
+int dsp_set_at(Node *node, const char *inlet, float value, double delay);
+int dsp_ramp(Node *node, const char *inlet, float time, bool exponential);
+int dsp_send(Node *node, const char *msg);
+int dsp_send_at(Node *node, const char *msg, double delay);
+double dsp_time(void);
+int dsp_set_threads(int n, bool deterministic);
+int dsp_set_profile(bool enabled);
+const DspStats* dsp_get_stats(void);
 
 #endif
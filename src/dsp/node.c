@@ -1,5 +1,102 @@
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
 #include "node.h"
 
+#define MXCSR_FTZ   0x8000 /* flush denormal results to zero */
+#define MXCSR_DAZ   0x0040 /* treat denormal inputs as zero */
+#define FPCR_FZ     (1 << 24)
+
+int node_samplerate = 44100;
+int node_buffer_size = 64;
+bool node_lock_memory = false;
+float node_denormal_offset = 0;
+
+
+void* node_alloc_memory(size_t size) {
+  void *p = calloc(1, size);
+  expect(p);
+
+  /* fault in every page now so the audio thread never has to; locking is
+  ** best effort as it is subject to the process's limits */
+  for (size_t i = 0; i < size; i += 4096) { ((volatile char*) p)[i] = 0; }
+  if (node_lock_memory) {
+#ifdef _WIN32
+    VirtualLock(p, size);
+#else
+    mlock(p, size);
+#endif
+  }
+  return p;
+}
+
+
+static void pool_push(NodePool *pool, void *p) {
+  *(void**) p = pool->free;
+  pool->free = p;
+  pool->count++;
+}
+
+
+/* sets the calling thread to flush denormals to zero, which otherwise
+** make decaying feedback loops many times slower. Returns the previous
+** state for `node_restore_denormals()` */
+unsigned node_flush_denormals(void) {
+#if defined(__SSE__)
+  unsigned state = _mm_getcsr();
+  _mm_setcsr(state | MXCSR_FTZ | MXCSR_DAZ);
+  return state;
+#elif defined(__aarch64__)
+  uint64_t state;
+  __asm__ volatile ("mrs %0, fpcr" : "=r" (state));
+  __asm__ volatile ("msr fpcr, %0" : : "r" (state | FPCR_FZ));
+  return state;
+#else
+  return 0;
+#endif
+}
+
+
+void node_restore_denormals(unsigned state) {
+#if defined(__SSE__)
+  _mm_setcsr(state);
+#elif defined(__aarch64__)
+  __asm__ volatile ("msr fpcr, %0" : : "r" ((uint64_t) state));
+#else
+  (void) state;
+#endif
+}
+
+
+void* node_alloc(NodeInfo *info, size_t size) {
+  NodePool *pool = &info->pool;
+  pool->size = size;
+
+  /* reuse a freed node if there is one */
+  void *p = pool->free;
+  if (p) {
+    pool->free = *(void**) p;
+    pool->count--;
+    *(void**) p = NULL;
+    return p;
+  }
+  return node_alloc_memory(size);
+}
+
+
+void node_reserve(NodeInfo *info, int count) {
+  NodePool *pool = &info->pool;
+  expect(pool->size > 0);
+  while (pool->count < count) {
+    pool_push(pool, node_alloc_memory(pool->size));
+  }
+}
+
 
 void node_init(Node *node, NodeInfo *info, NodeVtable *vtable, NodePort *inlets, NodePort *outlets) {
   memset(node, 0, sizeof(Node));
@@ -7,6 +104,13 @@ void node_init(Node *node, NodeInfo *info, NodeVtable *vtable, NodePort *inlets,
   node->vtable = vtable;
   node->inlets = inlets;
   node->outlets = outlets;
+  node->frames = NODE_BUFFER_SIZE;
+  /* ports start out zeroed */
+  for (int i = 0; info->inlets[i]; i++) {
+    inlets[i].constant = true;
+    inlets[i].filled = NODE_MAX_BUFFER_SIZE;
+  }
+  for (int i = 0; info->outlets[i]; i++) { outlets[i].constant = true; }
 }
 
 
@@ -31,12 +135,25 @@ void node_deinit(Node *node) {
       remove_link(&link->node->outlets[link->idx], node, j);
     }
   }
+
+  /* unlink all nodes this node is linked to */
+  for (int j = 0; node->info->outlets[j]; j++) {
+    NodePort *outlet = &node->outlets[j];
+    for (int i = 0; i < outlet->link_count; i++) {
+      NodeLink *link = &outlet->links[i];
+      remove_link(&link->node->inlets[link->idx], node, j);
+    }
+  }
 }
 
 
 void node_free(Node *node) {
-  node_deinit(node);
-  free(node);
+  /* the engine has already called `node_deinit()` on the audio thread. The
+  ** node is zeroed now rather than when it is next allocated, keeping that
+  ** cheap */
+  NodePool *pool = &node->info->pool;
+  memset(node, 0, pool->size);
+  pool_push(pool, node);
 }
 
 
@@ -53,30 +170,110 @@ static void mix_buffer(float *dst, float *src, int len) {
 }
 
 
-void node_process(Node *node) {
-  /* send all audio from outlets to connected inlets */
-  for (int j = 0; node->info->outlets[j]; j++) {
-    NodePort *outlet = &node->outlets[j];
+static void add_buffer(float *dst, float value, int len) {
+  for (int i = 0; i < len; i++) {
+    dst[i] += value;
+  }
+}
 
-    for (int i = 0; i < outlet->link_count; i++) {
-      NodeLink *link = &outlet->links[i];
-      NodePort *inlet = &link->node->inlets[link->idx];
 
-      /* replace audio if `replace` flag is set, otherwise mix */
-      if (inlet->replace) {
-        memcpy(inlet->buf, outlet->buf, sizeof(outlet->buf));
-        inlet->replace = false;
+/* `last` is the length of the block the port was last filled for */
+static void start_ramp(NodePort *port, float to, int last) {
+  float from = port->ramp_left > 0 ? port->ramp_value :
+               port->constant ? port->value : port->buf[last - 1];
+  int frames = port->ramp_time * NODE_SAMPLERATE;
+  port->ramp_to = to;
+  port->ramp_left = frames;
+  port->ramp_value = from;
+  if (frames <= 0) { return; }
+  /* exponential ramps need both ends on the same side of zero */
+  port->ramp_mul = port->ramp_exp && from * to > 0;
+  if (port->ramp_mul) {
+    port->ramp_step = pow(to / from, 1.0 / frames);
+  } else {
+    port->ramp_step = (to - from) / frames;
+  }
+}
+
+
+static void fill_port(NodePort *port, float value, int len) {
+  for (int i = 0; i < len; i++) {
+    port->buf[i] = value;
+  }
+  port->constant = true;
+  port->value = value;
+  port->filled = len;
+  port->ramp_to = value;
+  port->ramp_left = 0;
+}
+
+
+static void update_inlet(NodePort *port, int len, int last) {
+  float target = atomic_load_explicit(&port->target, memory_order_relaxed);
+  if (target != port->ramp_to) { start_ramp(port, target, last); }
+
+  if (port->ramp_left <= 0) {
+    /* also restores the set value to an inlet which was just unlinked, or
+    ** which its node wrote into. Only the block is filled; a longer block
+    ** than the port was filled for fills it again */
+    if (!port->constant || port->value != target || port->filled < len) {
+      fill_port(port, target, len);
+    }
+    return;
+  }
+
+  int n = port->ramp_left < len ? port->ramp_left : len;
+  float v = port->ramp_value;
+  for (int i = 0; i < n; i++) {
+    v = port->ramp_mul ? v * port->ramp_step : v + port->ramp_step;
+    port->buf[i] = v;
+  }
+  for (int i = n; i < len; i++) { port->buf[i] = target; }
+  port->ramp_left -= n;
+  port->ramp_value = port->ramp_left > 0 ? v : target;
+  port->constant = false;
+}
+
+
+void node_pull(Node *node, int len) {
+  int last = atomic_load_explicit(&node->frames, memory_order_relaxed);
+  /* sum the audio of all outlets linked to each inlet into the inlet; inlets
+  ** without links follow the value they were last set to. Constant outlets
+  ** are summed as scalars, the inlet is only constant if all of them are */
+  for (int j = 0; node->info->inlets[j]; j++) {
+    NodePort *inlet = &node->inlets[j];
+    if (inlet->link_count == 0) { update_inlet(inlet, len, last); continue; }
+
+    float sum = 0;
+    bool mixed = false;
+    for (int i = 0; i < inlet->link_count; i++) {
+      NodeLink *link = &inlet->links[i];
+      NodePort *outlet = &link->node->outlets[link->idx];
+      if (outlet->constant) {
+        sum += outlet->value;
+      } else if (!mixed) {
+        memcpy(inlet->buf, outlet->buf, sizeof(float) * len);
+        mixed = true;
       } else {
-        mix_buffer(inlet->buf, outlet->buf, NODE_BUFFER_SIZE);
+        mix_buffer(inlet->buf, outlet->buf, len);
       }
     }
+
+    if (!mixed) {
+      node_port_set(inlet, sum);
+    } else {
+      if (sum != 0) { add_buffer(inlet->buf, sum, len); }
+      inlet->constant = false;
+    }
   }
+}
 
-  /* reset `replace` flag on all inlets -- causes the next outlet write to
-  ** replace the buffer's existing audio instead of mixing to it */
-  for (int i = 0; node->info->inlets[i]; i++) {
-    node->inlets[i].replace = true;
+
+bool node_inlets_silent(Node *node) {
+  for (int j = 0; node->info->inlets[j]; j++) {
+    if (!node_port_silent(&node->inlets[j])) { return false; }
   }
+  return true;
 }
 
 
@@ -90,12 +287,28 @@ static int string_index(const char **arr, const char *name) {
 }
 
 
+void node_port_set(NodePort *port, float value) {
+  for (int i = 0; i < NODE_BUFFER_SIZE; i++) {
+    port->buf[i] = value;
+  }
+  port->constant = true;
+  port->value = value;
+  port->filled = NODE_BUFFER_SIZE;
+}
+
+
+/* sets a port's value for good rather than for a block: it becomes the
+** port's target */
+void node_port_hold(NodePort *port, float value) {
+  fill_port(port, value, NODE_BUFFER_SIZE);
+  atomic_store_explicit(&port->target, value, memory_order_relaxed);
+}
+
+
 int node_set(Node *node, const char *inlet, float value) {
   int idx = string_index(node->info->inlets, inlet);
   if (idx < 0) { return NODE_EBADINLET; }
-  for (int i = 0; i < NODE_BUFFER_SIZE; i++) {
-    node->inlets[idx].buf[i] = value;
-  }
+  node_port_hold(&node->inlets[idx], value);
   return NODE_ESUCCESS;
 }
 
@@ -103,41 +316,33 @@ int node_set(Node *node, const char *inlet, float value) {
 int node_get(Node *node, const char *outlet, float *value) {
   int idx = string_index(node->info->outlets, outlet);
   if (idx < 0) { return NODE_EBADOUTLET; }
-  *value = node->outlets[idx].buf[NODE_BUFFER_SIZE - 1];
+  int frames = atomic_load_explicit(&node->frames, memory_order_relaxed);
+  *value = node->outlets[idx].buf[frames - 1];
   return NODE_ESUCCESS;
 }
 
 
-int node_link(Node *from, const char *outlet, Node *to, const char *inlet) {
+int node_link(Node *from, int outlet, Node *to, int inlet) {
   node_unlink(from, outlet, to, inlet);
-  int idx1 = string_index(from->info->outlets, outlet);
-  int idx2 = string_index(  to->info->inlets,  inlet );
-  if (idx1 < 0) { return NODE_EBADOUTLET; }
-  if (idx2 < 0) { return NODE_EBADINLET;  }
 
-  NodePort *out = &from->outlets[idx1];
-  NodePort *in = &to->inlets[idx2];
+  NodePort *out = &from->outlets[outlet];
+  NodePort *in = &to->inlets[inlet];
   if (out->link_count == NODE_MAX_LINKS) { return NODE_EMAXLINKS; }
   if (in->link_count  == NODE_MAX_LINKS) { return NODE_EMAXLINKS; }
 
-  out->links[out->link_count++] = (NodeLink) { to,   idx2 };
-  in ->links[in ->link_count++] = (NodeLink) { from, idx1 };
+  out->links[out->link_count++] = (NodeLink) { to,   inlet  };
+  in ->links[in ->link_count++] = (NodeLink) { from, outlet };
 
   return NODE_ESUCCESS;
 }
 
 
-int node_unlink(Node *from, const char *outlet, Node *to, const char *inlet) {
-  int idx1 = string_index(from->info->outlets, outlet);
-  int idx2 = string_index(  to->info->inlets,  inlet );
-  if (idx1 < 0) { return NODE_EBADOUTLET; }
-  if (idx2 < 0) { return NODE_EBADINLET;  }
-
-  int err = remove_link(&from->outlets[idx1], to, idx2);
+int node_unlink(Node *from, int outlet, Node *to, int inlet) {
+  int err = remove_link(&from->outlets[outlet], to, inlet);
   if (err) { return NODE_EBADLINK; }
 
   /* this call should always succeed if the previous `remove_link` did */
-  remove_link(&to->inlets[idx2], from, idx1);
+  remove_link(&to->inlets[inlet], from, outlet);
 
   return NODE_ESUCCESS;
 }
@@ -2,13 +2,26 @@
 #define NODE_H
 
 #include <math.h>
+#include <stdatomic.h>
 #include "common.h"
 
-#define NODE_SAMPLERATE  44100
+/* samplerate and buffer size are set once by the engine before any nodes
+** are created; port storage is sized for the largest buffer size allowed.
+** A block split by timed events is processed as shorter blocks, whose
+** length is passed to each node rather than changing the buffer size */
+#define NODE_SAMPLERATE  node_samplerate
 #define NODE_SAMPLETIME  (1.0 / NODE_SAMPLERATE)
-#define NODE_BUFFER_SIZE 64
+#define NODE_BUFFER_SIZE node_buffer_size
+#define NODE_MAX_BUFFER_SIZE 512
 #define NODE_MAX_LINKS   32
+#define NODE_MAX_CHANNELS 16 /* audio device output channels */
 #define NODE_MAX_ERROR   128
+#define NODE_MAX_MESSAGE 1024
+#define NODE_STATS_BUCKETS 96
+#define NODE_SILENCE     1e-6 /* level below which a node's state counts as decayed */
+/* added to what feeds back into a node's state when the cpu can't flush
+** denormals to zero; zero when it can */
+#define NODE_DENORMAL_OFFSET node_denormal_offset
 
 enum {
   NODE_ESUCCESS   =  0,
@@ -17,6 +30,9 @@ enum {
   NODE_EBADOUTLET = -3,
   NODE_EBADLINK   = -4,
   NODE_EMAXLINKS  = -5,
+  NODE_EBADNODE   = -6,
+  NODE_EBADNAME   = -7,
+  NODE_EMAXNODES  = -8,
 };
 
 typedef struct Node Node;
@@ -25,22 +41,62 @@ typedef Node* (*NodeConstructor)(void);
 typedef struct { Node *node; int idx; } NodeLink;
 
 typedef struct {
-  float buf[NODE_BUFFER_SIZE];
+  float buf[NODE_MAX_BUFFER_SIZE];
   NodeLink links[NODE_MAX_LINKS];
   int link_count;
-  bool replace;
+  bool constant; /* every sample of `buf` equals `value` */
+  float value;
+  int filled;    /* samples of `buf` holding `value`, while constant */
+  /* unlinked inlets follow the value last set on them, which any thread may
+  ** store; the audio thread picks it up at the start of each block and
+  ** ramps to it over `ramp_time` seconds */
+  _Atomic float target;
+  float ramp_time;
+  bool ramp_exp, ramp_mul;
+  float ramp_to, ramp_value, ramp_step;
+  int ramp_left;
 } NodePort;
 
+typedef struct {
+  uint64_t blocks;
+  double total, max; /* nanoseconds */
+  int hist[NODE_STATS_BUCKETS];
+} NodeStats;
+
 typedef struct {
   int (*receive)(Node *node, const char *str, char *err);
-  void (*process)(Node *node);
+  void (*process)(Node *node, int len);
   void (*free)(Node *node);
+  /* sinks feeding the audio device write into its interleaved buffer here,
+  ** after every node has been processed. Channels set in `written` have
+  ** already been written by another sink and should be added to */
+  void (*output)(Node *node, float *buf, int len, int channels, uint32_t *written);
+  /* optional: processes several nodes of this type at once, side by side.
+  ** Used when nodes of one type share a plan level, such as the same node
+  ** in each voice of a polyphonic patch; their inlets are already pulled */
+  void (*process_batch)(Node **nodes, int count, int len);
+  /* optional, for messages which need memory: `prepare` is called by the
+  ** sender with the message and returns memory for it from
+  ** `node_alloc_memory()`, or NULL. The audio thread hands the memory to
+  ** `adopt` before `receive` gets the message; it returns memory the node
+  ** no longer needs, which is freed back on the main thread */
+  void* (*prepare)(Node *node, const char *msg);
+  void* (*adopt)(Node *node, void *mem);
 } NodeVtable;
 
+/* freed nodes of each type are kept for reuse, already zeroed */
+typedef struct {
+  void *free;
+  size_t size;
+  int count;
+} NodePool;
+
 typedef struct {
   const char *name;
   const char **inlets;
   const char **outlets;
+  bool sink; /* always processed, whether or not anything reads it */
+  NodePool pool;
 } NodeInfo;
 
 struct Node {
@@ -48,16 +104,41 @@ struct Node {
   NodeVtable *vtable;
   NodePort *inlets;
   NodePort *outlets;
+  /* used by the engine to order, schedule and profile processing */
+  int id, live_idx, sink_idx, mark, order, deps, level;
+  bool observed;
+  atomic_int pending;
+  /* samples in its ports from the last block processed, for other threads
+  ** reading them */
+  atomic_int frames;
+  NodeStats stats;
 };
 
+extern int node_samplerate;
+extern int node_buffer_size;
+extern bool node_lock_memory;
+extern float node_denormal_offset;
+
+void* node_alloc(NodeInfo *info, size_t size);
+void* node_alloc_memory(size_t size);
+unsigned node_flush_denormals(void);
+void node_restore_denormals(unsigned state);
+void node_reserve(NodeInfo *info, int count);
 void node_init(Node *node, NodeInfo *info, NodeVtable *vtable, NodePort *inlets, NodePort *outlets);
 void node_deinit(Node *node);
 void node_free(Node *node);
-void node_process(Node *node);
+void node_pull(Node *node, int len);
 int node_receive(Node *node, const char *str, char *err);
+void node_port_set(NodePort *port, float value);
+void node_port_hold(NodePort *port, float value);
+bool node_inlets_silent(Node *node);
+
+static inline bool node_port_silent(NodePort *port) {
+  return port->constant && port->value == 0;
+}
 int node_set(Node *node, const char *inlet, float value);
 int node_get(Node *node, const char *outlet, float *value);
-int node_link(Node *from, const char *outlet, Node *to, const char *inlet);
-int node_unlink(Node *from, const char *outlet, Node *to, const char *inlet);
+int node_link(Node *from, int outlet, Node *to, int inlet);
+int node_unlink(Node *from, int outlet, Node *to, int inlet);
 
 #endif
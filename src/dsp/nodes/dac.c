@@ -1,43 +1,80 @@
 #include "../node.h"
 
 
+/* the dac is a sink: its inlets are written straight into the audio device's
+** buffer, starting at the channel set by its `channel` message */
 typedef struct {
   Node node;
-  NodePort inl, inr;   /* inlets */
-  NodePort outl, outr; /* outlets */
+  NodePort inl, inr; /* inlets */
+  int channel;
 } DacNode;
 
 
-static void process(Node *node) {
+static void write_channel(float *buf, int len, int stride, NodePort *port, bool add) {
+  if (port->constant) {
+    float v = port->value;
+    if (add) {
+      for (int j = 0; j < len; j++) { buf[j*stride] += v; }
+    } else {
+      for (int j = 0; j < len; j++) { buf[j*stride] = v; }
+    }
+  } else if (add) {
+    for (int j = 0; j < len; j++) { buf[j*stride] += port->buf[j]; }
+  } else {
+    for (int j = 0; j < len; j++) { buf[j*stride] = port->buf[j]; }
+  }
+}
+
+
+static void output(Node *node, float *buf, int len, int channels, uint32_t *written) {
   DacNode *n = (DacNode*) node;
+  NodePort *ports[] = { &n->inl, &n->inr };
+  for (int i = 0; i < 2; i++) {
+    int ch = n->channel + i;
+    if (ch >= channels || node_port_silent(ports[i])) { continue; }
+    write_channel(buf + ch, len, channels, ports[i], *written & (1u << ch));
+    *written |= 1u << ch;
+  }
+}
+
+
+static void process(Node *node, int len) {}
 
-  /* copy inlet buffers to outlet buffers */
-  memcpy(n->outl.buf, n->inl.buf, sizeof(n->outl.buf));
-  memcpy(n->outr.buf, n->inr.buf, sizeof(n->outr.buf));
 
-  /* send output */
-  node_process(node);
+static int receive(Node *node, const char *msg, char *err) {
+  DacNode *n = (DacNode*) node;
+
+  char cmd[16] = "";
+  int val = 0;
+
+  sscanf(msg, "%15s %d", cmd, &val);
+  if (strcmp(cmd, "channel")) { sprintf(err, "bad command '%s'", cmd); return -1; }
+  if (val < 0 || val >= NODE_MAX_CHANNELS) { sprintf(err, "bad channel"); return -1; }
+  n->channel = val;
+
+  return 0;
 }
 
 
 Node* new_dac_node(void) {
-  DacNode *node = calloc(1, sizeof(DacNode));
-
   static const char *inlets[] = { "left", "right", NULL };
-  static const char *outlets[] = { "left", "right", NULL };
+  static const char *outlets[] = { NULL };
 
   static NodeInfo info = {
     .name = "dac",
     .inlets = inlets,
     .outlets = outlets,
+    .sink = true,
   };
 
   static NodeVtable vtable = {
     .process = process,
-    .receive = node_receive,
+    .receive = receive,
     .free = node_free,
+    .output = output,
   };
 
-  node_init(&node->node, &info, &vtable, &node->inl, &node->outl);
+  DacNode *node = node_alloc(&info, sizeof(DacNode));
+  node_init(&node->node, &info, &vtable, &node->inl, NULL);
   return &node->node;
 }
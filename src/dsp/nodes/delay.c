@@ -1,69 +1,154 @@
 #include "../node.h"
+#include "../delayline.h"
 
-static const char *cmd_strings[] = { "wet", "dry", NULL };
-enum { WET, DRY };
+static const char *cmd_strings[] = { "wet", "dry", "maxtime", "interp", NULL };
+enum { WET, DRY, MAXTIME, INTERP };
 
-#define BUFFER_SIZE 65536
-#define BUFFER_MASK (BUFFER_SIZE - 1)
+static const char *interp_strings[] = { "linear", "cubic", "allpass", NULL };
+enum { LINEAR, CUBIC, ALLPASS };
 
 typedef struct {
   Node node;
-  int idx;
+  int interp;
   float wet, dry;
-  float buf[BUFFER_SIZE];
+  float ap_last; /* last allpass output */
+  DelayLine *line;
   NodePort in, time, feedback; /* inlets */
   NodePort out;                /* outlets */
 } DelayNode;
 
 
-static void process(Node *node) {
+/* 4-point hermite interpolation between `x0` and `x1` */
+static inline float cubic(float xm1, float x0, float x1, float x2, float t) {
+  float c1 = 0.5f * (x1 - xm1);
+  float c2 = xm1 - 2.5f * x0 + 2.0f * x1 - 0.5f * x2;
+  float c3 = 0.5f * (x2 - xm1) + 1.5f * (x0 - x1);
+  return ((c3 * t + c2) * t + c1) * t + x0;
+}
+
+
+/* reads `d` samples behind the write index */
+static inline float read_line(DelayNode *n, float d) {
+  const float *buf = n->line->buf;
+  const int mask = n->line->mask;
+  const int idx = n->line->idx;
+  int di = d;
+  float frac = d - di;
+
+  switch (n->interp) {
+    case CUBIC: {
+      int i = idx - di;
+      return cubic(buf[(i + 1) & mask], buf[i & mask], buf[(i - 1) & mask], buf[(i - 2) & mask], frac);
+    }
+    case ALLPASS: {
+      /* keeping the fraction within [0.5, 1.5) keeps the filter's pole
+      ** well inside the unit circle */
+      if (frac < 0.5f) { di--; frac++; }
+      int i = idx - di;
+      float a = (1 - frac) / (1 + frac);
+      n->ap_last = buf[(i - 1) & mask] + a * (buf[i & mask] - n->ap_last);
+      return n->ap_last;
+    }
+  }
+  int i = idx - di;
+  return lerpf(buf[i & mask], buf[(i - 1) & mask], frac);
+}
+
+
+/* cubic and allpass reads reach a sample closer than linear ones do */
+static inline float delay_samples(DelayNode *n, float time) {
+  float min = n->interp == LINEAR ? 1 : 2;
+  float max = n->line->mask - 3;
+  return clampf(fabs(time) * NODE_SAMPLERATE, min, max);
+}
+
+
+static void process(Node *node, int len) {
   DelayNode *n = (DelayNode*) node;
 
-  for (int i = 0; i < NODE_BUFFER_SIZE; i++) {
-    /* read */
-    double fidx = n->idx - fabs(n->time.buf[i]) * NODE_SAMPLERATE;
-    float frac = fmod(fidx, 1.0);
-    int idx1 = (int) fidx & BUFFER_MASK;
-    int idx2 = (idx1 + 1) & BUFFER_MASK;
-    float out = lerpf(n->buf[idx1], n->buf[idx2], frac);
+  /* no input and everything in the buffer has decayed */
+  if (node_port_silent(&n->in) && delayline_silent(n->line)) {
+    node_port_set(&n->out, 0);
+    return;
+  }
 
-    /* write */
-    float in = n->in.buf[i];
-    n->buf[n->idx] = in + out * n->feedback.buf[i];
-    n->idx = (n->idx + 1) & BUFFER_MASK;
+  /* a whole number of samples needs no interpolating */
+  float d = delay_samples(n, n->time.value);
+  if (n->time.constant && d == (int) d) {
+    const float *buf = n->line->buf;
+    for (int i = 0; i < len; i++) {
+      float out = buf[(n->line->idx - (int) d) & n->line->mask];
+      float in = n->in.buf[i];
+      delayline_write(n->line, in + out * n->feedback.buf[i]);
+      n->out.buf[i] = out * n->wet + in * n->dry;
+    }
+    return;
+  }
 
-    /* output */
+  for (int i = 0; i < len; i++) {
+    if (!n->time.constant) { d = delay_samples(n, n->time.buf[i]); }
+    float out = read_line(n, d);
+    float in = n->in.buf[i];
+    delayline_write(n->line, in + out * n->feedback.buf[i]);
     n->out.buf[i] = out * n->wet + in * n->dry;
   }
+}
+
+
+/* the default line is allocated right after the node */
+static DelayLine* pooled_line(DelayNode *n) {
+  return (DelayLine*) (n + 1);
+}
+
+
+static void* prepare(Node *node, const char *msg) {
+  return delayline_prepare(msg);
+}
 
-  /* send output */
-  node_process(node);
+
+static void* adopt(Node *node, void *mem) {
+  DelayNode *n = (DelayNode*) node;
+  n->ap_last = 0;
+  return delayline_adopt(&n->line, pooled_line(n), mem);
 }
 
 
 static int receive(Node *node, const char *msg, char *err) {
   DelayNode *n = (DelayNode*) node;
 
-  char cmd[16] = "";
+  char cmd[16] = "", arg[16] = "";
   float val = 0;
 
-  sscanf(msg, "%15s %f", cmd, &val);
+  sscanf(msg, "%15s %15s", cmd, arg);
+  sscanf(arg, "%f", &val);
   int prm = string_to_enum(cmd_strings, cmd);
   if (prm < 0) { sprintf(err, "bad command '%s'", cmd); return -1; }
-  val = clampf(val, 0.0, 1.0);
 
   switch (prm) {
-    case WET : n->wet = val; break;
-    case DRY : n->dry = val; break;
+    case WET : n->wet = clampf(val, 0.0, 1.0); break;
+    case DRY : n->dry = clampf(val, 0.0, 1.0); break;
+    case MAXTIME : return delayline_receive_maxtime(n->line, msg, err);
+    case INTERP : {
+      int idx = string_to_enum(interp_strings, arg);
+      if (idx < 0) { sprintf(err, "bad interpolation '%s'", arg); return -1; }
+      n->interp = idx;
+      n->ap_last = 0;
+      break;
+    }
   }
 
   return 0;
 }
 
 
-Node* new_delay_node(void) {
-  DelayNode *node = calloc(1, sizeof(DelayNode));
+static void free_node(Node *node) {
+  DelayNode *n = (DelayNode*) node;
+  delayline_free(n->line, pooled_line(n));
+  node_free(node);
+}
+
 
+Node* new_delay_node(void) {
   static const char *inlets[] = { "in", "time", "feedback", NULL };
   static const char *outlets[] = { "out", NULL };
 
@@ -76,10 +161,15 @@ Node* new_delay_node(void) {
   static NodeVtable vtable = {
     .process = process,
     .receive = receive,
-    .free = node_free,
+    .prepare = prepare,
+    .adopt = adopt,
+    .free = free_node,
   };
 
+  size_t size = sizeof(DelayNode) + delayline_size(DELAYLINE_DEFAULT_MAXTIME);
+  DelayNode *node = node_alloc(&info, size);
   node_init(&node->node, &info, &vtable, &node->in, &node->out);
+  node->line = delayline_init(pooled_line(node), DELAYLINE_DEFAULT_MAXTIME);
   node->wet = 1.0;
   node->dry = 0.0;
   node_set(&node->node, "feedback", 0.5);
@@ -0,0 +1,88 @@
+#include "../node.h"
+#include "../stream.h"
+
+
+/* a sink which records its inlets to a file, opened with `open filename
+** [bits]` and finished with `close`. The file io happens on the stream
+** writer thread, so opening completes shortly after the message */
+typedef struct {
+  Node node;
+  Stream *stream;
+  float buf[NODE_MAX_BUFFER_SIZE * 2];
+  NodePort inl, inr; /* inlets */
+} FileNode;
+
+
+static void process(Node *node, int len) {
+  FileNode *n = (FileNode*) node;
+
+  /* interleave */
+  for (int i = 0; i < len; i++) {
+    n->buf[i*2+0] = n->inl.buf[i];
+    n->buf[i*2+1] = n->inr.buf[i];
+  }
+  stream_write(n->stream, n->buf, len);
+}
+
+
+static int receive(Node *node, const char *msg, char *err) {
+  FileNode *n = (FileNode*) node;
+
+  char cmd[16] = "";
+  char filename[STREAM_MAX_FILENAME] = "";
+  int bits = 32;
+
+  sscanf(msg, "%15s %255s %d", cmd, filename, &bits);
+
+  if (!strcmp(cmd, "open")) {
+    if (!*filename) { sprintf(err, "expected filename"); return -1; }
+    if (bits != 16 && bits != 24 && bits != 32) {
+      sprintf(err, "expected 16, 24 or 32 bits"); return -1;
+    }
+    if (!stream_request_open(n->stream, filename, NODE_SAMPLERATE, bits)) {
+      sprintf(err, "file already open or still closing"); return -1;
+    }
+    return 0;
+  }
+
+  if (!strcmp(cmd, "close")) {
+    if (!stream_request_close(n->stream)) {
+      sprintf(err, "no file open"); return -1;
+    }
+    return 0;
+  }
+
+  sprintf(err, "bad command '%s'", cmd);
+  return -1;
+}
+
+
+static void free_node(Node *node) {
+  FileNode *n = (FileNode*) node;
+  stream_free(n->stream);
+  node_free(node);
+}
+
+
+Node* new_file_node(void) {
+  static const char *inlets[] = { "left", "right", NULL };
+  static const char *outlets[] = { NULL };
+
+  static NodeInfo info = {
+    .name = "file",
+    .inlets = inlets,
+    .outlets = outlets,
+    .sink = true,
+  };
+
+  static NodeVtable vtable = {
+    .process = process,
+    .receive = receive,
+    .free = free_node,
+  };
+
+  FileNode *node = node_alloc(&info, sizeof(FileNode));
+  node_init(&node->node, &info, &vtable, &node->inl, NULL);
+  node->stream = stream_new(2);
+  return &node->node;
+}
@@ -30,11 +30,17 @@ static void handle_next_point(LineNode *n) {
 }
 
 
-static void process(Node *node) {
+static void process(Node *node, int len) {
   LineNode *n = (LineNode*) node;
 
+  /* finished: output holds the last value */
+  if (!n->active) {
+    node_port_set(&n->out, n->cur);
+    return;
+  }
+
   /* update */
-  for (int i = 0; i < NODE_BUFFER_SIZE; i++) {
+  for (int i = 0; i < len; i++) {
     n->out.buf[i] = n->cur;
     if (!n->active) { continue; }
 
@@ -46,9 +52,6 @@ static void process(Node *node) {
       handle_next_point(n);
     }
   }
-
-  /* send output */
-  node_process(node);
 }
 
 
@@ -83,8 +86,6 @@ static int receive(Node *node, const char *msg, char *err) {
 
 
 Node* new_line_node(void) {
-  LineNode *node = calloc(1, sizeof(LineNode));
-
   static const char *inlets[] = { NULL };
   static const char *outlets[] = { "out", NULL };
 
@@ -100,6 +101,7 @@ Node* new_line_node(void) {
     .free = node_free,
   };
 
+  LineNode *node = node_alloc(&info, sizeof(LineNode));
   node_init(&node->node, &info, &vtable, NULL, &node->out);
   node->active = false;
 
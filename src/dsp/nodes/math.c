@@ -1,11 +1,13 @@
 #include "../node.h"
 
 static const char *op_strings[] = { "+", "*", "/", "-", "^", "min", "max", NULL };
-enum { ADD, MUL, DIV, SUB, POW, MIN, MAX, SET };
+enum { ADD, MUL, DIV, SUB, POW, MIN, MAX, SET, POWI };
 
 #define MAX_OPS 16
+#define MAX_POWI 16 /* largest constant exponent done by multiplying */
+#define TILE 32     /* samples run through every op at a time */
 
-typedef struct { int op, inlet; float value; } Op;
+typedef struct { int op, inlet; float value; int exponent; } Op;
 
 typedef struct {
   Node node;
@@ -16,6 +18,86 @@ typedef struct {
 } MathNode;
 
 
+/* x to the integer power n, by squaring */
+static inline float powi(float x, int n) {
+  float res = 1;
+  for (int e = abs(n); e; e >>= 1) {
+    if (e & 1) { res *= x; }
+    x *= x;
+  }
+  return n < 0 ? 1 / res : res;
+}
+
+
+/* log2 and exp2 from the float's exponent bits and a polynomial for the
+** rest; `fast_pow()` built on them is within a few parts per million */
+static inline float fast_log2(float x) {
+  union { float f; int32_t i; } u = { x };
+  /* split into 2^e * m with m in [sqrt(0.5), sqrt(2)) */
+  int32_t e = (u.i - 0x3f3504f3) >> 23;
+  u.i -= e * (1 << 23);
+  float t = (u.f - 1) / (u.f + 1), t2 = t * t;
+  float p = 0.14285714f;
+  p = p * t2 + 0.2f;
+  p = p * t2 + 0.33333333f;
+  p = p * t2 + 1;
+  return e + 2.8853900818f * t * p;
+}
+
+
+static inline float fast_exp2(float x) {
+  x = clampf(x, -126, 127);
+  float i = floorf(x + 0.5f), f = x - i; /* f in [-0.5, 0.5] */
+  float p = 1.5403530e-4f;
+  p = p * f + 1.3333558e-3f;
+  p = p * f + 9.6181291e-3f;
+  p = p * f + 5.5504109e-2f;
+  p = p * f + 2.4022651e-1f;
+  p = p * f + 6.9314718e-1f;
+  p = p * f + 1;
+  union { int32_t i; float f; } u = { ((int32_t) i + 127) << 23 };
+  return p * u.f;
+}
+
+
+/* `pow()` for a positive base */
+static inline float fast_pow(float x, float y) {
+  return fast_exp2(y * fast_log2(x));
+}
+
+
+/* anything but a positive base is left to libm */
+static inline float pow_any(float x, float y) {
+  return x > 0 ? fast_pow(x, y) : pow(x, y);
+}
+
+
+static void pow_loop(float *acc, const float *buf, float value, int len) {
+  float res[TILE];
+  for (int i = 0; i < len; i++) {
+    res[i] = fast_pow(fabsf(acc[i]), buf ? buf[i] : value);
+  }
+  for (int i = 0; i < len; i++) {
+    acc[i] = acc[i] > 0 ? res[i] : pow(acc[i], buf ? buf[i] : value);
+  }
+}
+
+
+static void powi_loop(float *acc, int n, int len) {
+  float base[TILE], res[TILE];
+  for (int i = 0; i < len; i++) { base[i] = acc[i]; res[i] = 1; }
+  for (int e = abs(n); e; e >>= 1) {
+    if (e & 1) { for (int i = 0; i < len; i++) { res[i] *= base[i]; } }
+    for (int i = 0; i < len; i++) { base[i] *= base[i]; }
+  }
+  if (n < 0) {
+    for (int i = 0; i < len; i++) { acc[i] = 1 / res[i]; }
+  } else {
+    for (int i = 0; i < len; i++) { acc[i] = res[i]; }
+  }
+}
+
+
 #define set(a, b) (b)
 #define add(a, b) ((a) + (b))
 #define sub(a, b) ((a) - (b))
@@ -23,36 +105,101 @@ typedef struct {
 #define div(a, b) ((a) / (b))
 
 #define op_loop(f)                                \
-  if (op.inlet >= 0) {                            \
-    float *buf = node->inlets[op.inlet].buf;      \
-    for (int i = 0; i < NODE_BUFFER_SIZE; i++) {  \
-      n->out.buf[i] = f(n->out.buf[i], buf[i]);   \
+  if (buf) {                                      \
+    for (int i = 0; i < span; i++) {              \
+      acc[i] = f(acc[i], buf[i]);                 \
     }                                             \
   } else {                                        \
-    for (int i = 0; i < NODE_BUFFER_SIZE; i++) {  \
-      n->out.buf[i] = f(n->out.buf[i], op.value); \
+    for (int i = 0; i < span; i++) {              \
+      acc[i] = f(acc[i], value);                  \
     }                                             \
   }
 
-static void process(Node *node) {
-  MathNode *n = (MathNode*) node;
+#define op_scalar(f) res = f(res, value)
 
+#define op_switch(m, powi_m)                \
+  switch (op.op) {                          \
+    case SET  : m(set);  break;             \
+    case ADD  : m(add);  break;             \
+    case SUB  : m(sub);  break;             \
+    case MUL  : m(mul);  break;             \
+    case DIV  : m(div);  break;             \
+    case POW  : m(pow_any); break;          \
+    case MIN  : m(minf); break;             \
+    case MAX  : m(maxf); break;             \
+    case POWI : powi_m;  break;             \
+  }
+
+/* works out whether the ops give zero for this block without running them */
+static bool is_silent(MathNode *n) {
+  bool zero = false;
   for (int j = 0; j < n->op_count; j++) {
     const Op op = n->ops[j];
+    bool z = op.inlet >= 0 ? node_port_silent(&n->node.inlets[op.inlet]) : op.value == 0;
     switch (op.op) {
-      case SET : op_loop(set);  break;
-      case ADD : op_loop(add);  break;
-      case SUB : op_loop(sub);  break;
-      case MUL : op_loop(mul);  break;
-      case DIV : op_loop(div);  break;
-      case POW : op_loop(pow);  break;
-      case MIN : op_loop(minf); break;
-      case MAX : op_loop(maxf); break;
+      case SET : zero = z;                                     break;
+      case MUL : zero = zero || z;                             break;
+      case DIV : zero = zero && !z;                            break;
+      case POW : zero = zero && op.inlet < 0 && op.value > 0;  break;
+      case POWI: zero = zero && op.exponent > 0;               break;
+      default  : zero = zero && z;                             break;
     }
   }
+  return zero;
+}
 
-  /* send output */
-  node_process(node);
+
+/* if every inlet used is constant the ops only need doing once */
+static bool is_constant(MathNode *n, float *out) {
+  float res = 0;
+  for (int j = 0; j < n->op_count; j++) {
+    const Op op = n->ops[j];
+    NodePort *inlet = op.inlet >= 0 ? &n->node.inlets[op.inlet] : NULL;
+    if (inlet && !inlet->constant) { return false; }
+    const float value = inlet ? inlet->value : op.value;
+    op_switch(op_scalar, res = powi(res, op.exponent));
+  }
+  *out = res;
+  return true;
+}
+
+
+static void process(Node *node, int len) {
+  MathNode *n = (MathNode*) node;
+  float res;
+
+  if (is_silent(n)) {
+    node_port_set(&n->out, 0);
+    return;
+  }
+  if (is_constant(n, &res)) {
+    node_port_set(&n->out, res);
+    return;
+  }
+
+  /* the ops are run together over a tile of samples, which is only written
+  ** out once every op is done with it. 32 samples fit in half the vector
+  ** registers even without AVX, leaving the rest for operands, and a tile
+  ** of fixed length lets the compiler unroll each op's loop completely.
+  ** Port buffers are always NODE_MAX_BUFFER_SIZE long, so the last tile of
+  ** a split block may safely run past `len` */
+  for (int pos = 0; pos < len; pos += TILE) {
+    const int span = TILE;
+    float acc[TILE];
+    for (int j = 0; j < n->op_count; j++) {
+      const Op op = n->ops[j];
+      /* constant inlets are used as scalars */
+      NodePort *inlet = op.inlet >= 0 ? &node->inlets[op.inlet] : NULL;
+      const float *buf = inlet && !inlet->constant ? inlet->buf + pos : NULL;
+      const float value = inlet ? inlet->value : op.value;
+      if (op.op == POW) {
+        pow_loop(acc, buf, value, span);
+        continue;
+      }
+      op_switch(op_loop, powi_loop(acc, op.exponent, span));
+    }
+    memcpy(n->out.buf + pos, acc, sizeof(acc));
+  }
 }
 
 
@@ -69,6 +216,12 @@ static int push_op(MathNode *n, int op_enum, char *val, char *err) {
     }
   }
 
+  /* constant whole powers are cheaper as multiplies */
+  if (op_enum == POW && op->inlet < 0 && fabs(op->value) <= MAX_POWI && op->value == (int) op->value) {
+    op->op = POWI;
+    op->exponent = op->value;
+  }
+
   if (n->op_count++ >= MAX_OPS) {
     sprintf(err, "too many operations"); return -1;
   }
@@ -106,8 +259,6 @@ static int receive(Node *node, const char *msg, char *err) {
 
 
 Node* new_math_node(void) {
-  MathNode *node = calloc(1, sizeof(MathNode));
-
   static const char *inlets[] = { "in", "in2", "in3", NULL };
   static const char *outlets[] = { "out", NULL };
 
@@ -123,6 +274,7 @@ Node* new_math_node(void) {
     .free = node_free,
   };
 
+  MathNode *node = node_alloc(&info, sizeof(MathNode));
   node_init(&node->node, &info, &vtable, &node->in, &node->out);
   node->node.vtable->receive(&node->node, "set in", NULL);
 
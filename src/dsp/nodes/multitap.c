@@ -0,0 +1,193 @@
+#include "../node.h"
+#include "../delayline.h"
+
+static const char *cmd_strings[] = { "tap", "maxtime", NULL };
+enum { TAP, MAXTIME };
+
+#define MAX_TAPS 8
+
+/* several read taps over one delay line: each tap has its own time, gain
+** and pan, and their sum is fed back into the line */
+typedef struct {
+  float time, gain, pan;
+  float gain_l, gain_r;
+} Tap;
+
+typedef struct {
+  Node node;
+  int tap_count;
+  Tap taps[MAX_TAPS];
+  DelayLine *line;
+  NodePort in, feedback; /* inlets */
+  NodePort left, right;  /* outlets */
+} MultitapNode;
+
+
+static inline float delay_samples(MultitapNode *n, Tap *tap) {
+  return clampf(tap->time * NODE_SAMPLERATE, 1, n->line->mask - 3);
+}
+
+
+/* adds a tap's whole block to the outputs. Only used when the tap reaches
+** back further than a block, so none of what it reads is written during
+** the block; the samples it needs are copied out of the ring first so the
+** interpolation runs over contiguous memory */
+static void read_block(MultitapNode *n, Tap *tap, float *mono, float *l, float *r, int len) {
+  float tmp[NODE_MAX_BUFFER_SIZE + 1];
+  float d = delay_samples(n, tap);
+  int di = d;
+  float frac = d - di;
+  int mask = n->line->mask;
+  int start = (n->line->idx - di - 1) & mask;
+  int span = len + 1;
+  int first = mask + 1 - start < span ? mask + 1 - start : span;
+  memcpy(tmp, n->line->buf + start, first * sizeof(float));
+  memcpy(tmp + first, n->line->buf, (span - first) * sizeof(float));
+
+  for (int i = 0; i < len; i++) {
+    float v = tmp[i + 1] + (tmp[i] - tmp[i + 1]) * frac;
+    mono[i] += v * tap->gain;
+    l[i] += v * tap->gain_l;
+    r[i] += v * tap->gain_r;
+  }
+}
+
+
+static void process(Node *node, int len) {
+  MultitapNode *n = (MultitapNode*) node;
+
+  /* no input and everything in the buffer has decayed */
+  if (node_port_silent(&n->in) && delayline_silent(n->line)) {
+    node_port_set(&n->left, 0);
+    node_port_set(&n->right, 0);
+    return;
+  }
+
+  float mono[NODE_MAX_BUFFER_SIZE] = { 0 };
+  float *l = n->left.buf, *r = n->right.buf;
+  memset(l, 0, sizeof(float) * len);
+  memset(r, 0, sizeof(float) * len);
+
+  /* silent taps, such as those never set, are skipped */
+  Tap *taps[MAX_TAPS];
+  int count = 0;
+  bool block = true;
+  for (int j = 0; j < n->tap_count; j++) {
+    if (n->taps[j].gain == 0) { continue; }
+    taps[count++] = &n->taps[j];
+    if (delay_samples(n, &n->taps[j]) < len) { block = false; }
+  }
+
+  if (block) {
+    for (int j = 0; j < count; j++) {
+      read_block(n, taps[j], mono, l, r, len);
+    }
+    for (int i = 0; i < len; i++) {
+      delayline_write(n->line, n->in.buf[i] + mono[i] * n->feedback.buf[i]);
+    }
+    return;
+  }
+
+  /* a tap closer than a block reads what the block itself writes */
+  const float *buf = n->line->buf;
+  int mask = n->line->mask;
+  for (int i = 0; i < len; i++) {
+    for (int j = 0; j < count; j++) {
+      Tap *tap = taps[j];
+      float d = delay_samples(n, tap);
+      int di = d;
+      int k = n->line->idx - di;
+      float v = lerpf(buf[k & mask], buf[(k - 1) & mask], d - di);
+      mono[i] += v * tap->gain;
+      l[i] += v * tap->gain_l;
+      r[i] += v * tap->gain_r;
+    }
+    delayline_write(n->line, n->in.buf[i] + mono[i] * n->feedback.buf[i]);
+  }
+}
+
+
+/* the default line is allocated right after the node */
+static DelayLine* pooled_line(MultitapNode *n) {
+  return (DelayLine*) (n + 1);
+}
+
+
+static void* prepare(Node *node, const char *msg) {
+  return delayline_prepare(msg);
+}
+
+
+static void* adopt(Node *node, void *mem) {
+  MultitapNode *n = (MultitapNode*) node;
+  return delayline_adopt(&n->line, pooled_line(n), mem);
+}
+
+
+static int receive(Node *node, const char *msg, char *err) {
+  MultitapNode *n = (MultitapNode*) node;
+
+  char cmd[16] = "";
+  sscanf(msg, "%15s", cmd);
+  int prm = string_to_enum(cmd_strings, cmd);
+  if (prm < 0) { sprintf(err, "bad command '%s'", cmd); return -1; }
+
+  switch (prm) {
+    case TAP : {
+      int idx;
+      Tap tap = { .pan = 0 };
+      if (sscanf(msg, "tap %d %f %f %f", &idx, &tap.time, &tap.gain, &tap.pan) < 3) {
+        sprintf(err, "expected tap index, time, gain and optional pan"); return -1;
+      }
+      if (idx < 0 || idx >= MAX_TAPS) {
+        sprintf(err, "tap index should be from 0 to %d", MAX_TAPS - 1); return -1;
+      }
+      /* constant power pan from -1 (left) to 1 (right) */
+      tap.time = fabs(tap.time);
+      tap.pan = clampf(tap.pan, -1, 1);
+      float angle = (tap.pan + 1) * 3.141592 / 4;
+      tap.gain_l = tap.gain * cos(angle);
+      tap.gain_r = tap.gain * sin(angle);
+      n->taps[idx] = tap;
+      if (idx >= n->tap_count) { n->tap_count = idx + 1; }
+      break;
+    }
+    case MAXTIME : return delayline_receive_maxtime(n->line, msg, err);
+  }
+
+  return 0;
+}
+
+
+static void free_node(Node *node) {
+  MultitapNode *n = (MultitapNode*) node;
+  delayline_free(n->line, pooled_line(n));
+  node_free(node);
+}
+
+
+Node* new_multitap_node(void) {
+  static const char *inlets[] = { "in", "feedback", NULL };
+  static const char *outlets[] = { "left", "right", NULL };
+
+  static NodeInfo info = {
+    .name = "multitap",
+    .inlets = inlets,
+    .outlets = outlets,
+  };
+
+  static NodeVtable vtable = {
+    .process = process,
+    .receive = receive,
+    .prepare = prepare,
+    .adopt = adopt,
+    .free = free_node,
+  };
+
+  size_t size = sizeof(MultitapNode) + delayline_size(DELAYLINE_DEFAULT_MAXTIME);
+  MultitapNode *node = node_alloc(&info, size);
+  node_init(&node->node, &info, &vtable, &node->in, &node->left);
+  node->line = delayline_init(pooled_line(node), DELAYLINE_DEFAULT_MAXTIME);
+
+  return &node->node;
+}
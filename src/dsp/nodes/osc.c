@@ -1,48 +1,222 @@
 #include "../node.h"
 
-static const char *mode_strings[] = { "phase", "sine", "saw", "pulse", "noise", NULL };
-enum { PHASE, SINE, SAW, PULSE, NOISE };
+static const char *mode_strings[] = {
+  "phase", "sine", "saw", "pulse", "noise", "bl-saw", "bl-pulse", NULL
+};
+enum { PHASE, SINE, SAW, PULSE, NOISE, BL_SAW, BL_PULSE };
+
+#define NOISE_LANES 8
 
 typedef struct {
   Node node;
   int mode;
+  uint32_t seed[NOISE_LANES];
   double autophase;
+  float last_phase;
   NodePort phase, freq; /* inlets */
   NodePort out;         /* outlets */
 } OscNode;
 
 
-static void update_phase(OscNode *n) {
-  for (int i = 0; i < NODE_BUFFER_SIZE; i++) {
-    n->autophase += fabs(n->freq.buf[i]) * NODE_SAMPLETIME;
-    if (n->autophase >= 1.0) { n->autophase -= floor(n->autophase); }
-    n->phase.buf[i] = n->autophase;
+/* per-node xorshift generators: unlike `rand()` they hold no shared state,
+** so nodes give the same noise whichever thread processes them. Each lane
+** runs its own generator so a block is filled several samples at a time */
+static void fill_noise(OscNode *n, int len) {
+  uint32_t s[NOISE_LANES];
+  memcpy(s, n->seed, sizeof(s));
+  /* port buffers are sized for the largest block, so whole lanes fit */
+  for (int i = 0; i < len; i += NOISE_LANES) {
+    for (int k = 0; k < NOISE_LANES; k++) {
+      s[k] ^= s[k] << 13;
+      s[k] ^= s[k] >> 17;
+      s[k] ^= s[k] << 5;
+      n->out.buf[i + k] = 1.0f - (int32_t) (s[k] >> 8) * (2.0f / 16777216);
+    }
+  }
+  memcpy(n->seed, s, sizeof(s));
+}
+
+
+/* sin(2 pi phase) as an odd polynomial over a quarter turn */
+static inline float fast_sin(float phase) {
+  float x = phase - floorf(phase + 0.5f);        /* [-0.5, 0.5) */
+  x = x > 0.25f ? 0.5f - x : x < -0.25f ? -0.5f - x : x; /* [-0.25, 0.25] */
+  float y = x * 6.28318531f, y2 = y * y;
+  float p = -2.50521084e-8f;
+  p = p * y2 + 2.75573192e-6f;
+  p = p * y2 - 1.98412698e-4f;
+  p = p * y2 + 8.33333333e-3f;
+  p = p * y2 - 1.66666667e-1f;
+  return y + y * y2 * p;
+}
+
+
+/* polynomial band-limited step, spread over the samples either side of phase
+** 0: it is added where the wave jumps up by 2 there, as the saw does going
+** from -1 to 1, and subtracted where it jumps down by 2, as the pulse does
+** going from 1 to -1. The pulse's rise at phase 0.5 is handled by shifting
+** its phase to put the rise at 0 and adding. `dt` is the phase step */
+static inline float blep(float t, float dt) {
+  if (t < dt) { t /= dt; return t + t - t * t - 1; }
+  if (t > 1 - dt) { t = (t - 1) / dt; return t * t + t + t + 1; }
+  return 0;
+}
+
+
+static void update_phase(OscNode *n, int len) {
+  if (n->freq.constant) {
+    double step = fabs(n->freq.value) * NODE_SAMPLETIME;
+    for (int i = 0; i < len; i++) {
+      n->autophase += step;
+      if (n->autophase >= 1.0) { n->autophase -= floor(n->autophase); }
+      n->phase.buf[i] = n->autophase;
+    }
+  } else {
+    for (int i = 0; i < len; i++) {
+      n->autophase += fabs(n->freq.buf[i]) * NODE_SAMPLETIME;
+      if (n->autophase >= 1.0) { n->autophase -= floor(n->autophase); }
+      n->phase.buf[i] = n->autophase;
+    }
+  }
+  n->phase.constant = false;
+}
+
+
+static inline float wave(int mode, float phase) {
+  phase = clampf(phase, 0.0, 1.0);
+  switch (mode) {
+    case PHASE    : return phase;
+    case SINE     : return fast_sin(phase);
+    case SAW      :
+    case BL_SAW   : return 1.0 - 2.0 * phase;
+    case PULSE    :
+    case BL_PULSE : return phase < 0.5 ? -1.0 : 1.0;
+  }
+  return 0;
+}
+
+
+/* the band-limited modes work out each sample's phase step from the phase
+** itself, so they also work when the phase inlet is linked */
+static void write_bl(OscNode *n, int len) {
+  const float *phase = n->phase.buf;
+  float *out = n->out.buf;
+  float last = n->last_phase;
+  bool saw = n->mode == BL_SAW;
+
+  for (int i = 0; i < len; i++) {
+    float p = clampf(phase[i], 0.0, 1.0);
+    float dt = p - last;
+    dt -= floorf(dt);
+    dt = minf(dt, 1 - dt);
+    last = p;
+    if (saw) {
+      out[i] = 1.0f - 2.0f * p + blep(p, dt);
+    } else {
+      float p2 = p + 0.5f;
+      p2 -= floorf(p2);
+      out[i] = (p < 0.5f ? -1.0f : 1.0f) - blep(p, dt) + blep(p2, dt);
+    }
   }
 }
 
 
-static void process(Node *node) {
+static void write_output(OscNode *n, int len) {
+  const float *phase = n->phase.buf;
+  float *out = n->out.buf;
+
+  if (n->mode == NOISE) {
+    fill_noise(n, len);
+    return;
+  }
+
+  /* a linked phase which does not move gives a constant output */
+  if (n->phase.constant) {
+    n->last_phase = n->phase.value;
+    node_port_set(&n->out, wave(n->mode, n->phase.value));
+    return;
+  }
+
+  switch (n->mode) {
+    case PHASE :
+      for (int i = 0; i < len; i++) { out[i] = clampf(phase[i], 0.0, 1.0); }
+      break;
+    case SINE :
+      for (int i = 0; i < len; i++) { out[i] = fast_sin(clampf(phase[i], 0.0, 1.0)); }
+      break;
+    case SAW :
+      for (int i = 0; i < len; i++) { out[i] = 1.0f - 2.0f * clampf(phase[i], 0.0, 1.0); }
+      break;
+    case PULSE :
+      for (int i = 0; i < len; i++) { out[i] = phase[i] < 0.5f ? -1.0f : 1.0f; }
+      break;
+    case BL_SAW :
+    case BL_PULSE :
+      write_bl(n, len);
+      break;
+  }
+  n->last_phase = phase[len - 1];
+}
+
+
+static void process(Node *node, int len) {
   OscNode *n = (OscNode*) node;
 
   /* auto-update phase if we don't have links to the phase inlet */
   if (n->phase.link_count == 0) {
-    update_phase(n);
+    update_phase(n, len);
+  }
+  write_output(n, len);
+}
+
+
+/* the phases of a batch's free running oscillators are advanced LANES at a
+** time, side by side, so the per-sample loop over lanes can be vectorized */
+#define LANES 8
+
+static void update_phases(OscNode **n, int lanes, int len) {
+  /* deterministic threads run batches on every worker */
+  static _Thread_local double step[NODE_MAX_BUFFER_SIZE][LANES];
+  double phase[LANES] = { 0 };
+
+  for (int k = 0; k < LANES; k++) {
+    NodePort *freq = k < lanes ? &n[k]->freq : NULL;
+    for (int i = 0; i < len; i++) {
+      float f = !freq ? 0 : freq->constant ? freq->value : freq->buf[i];
+      step[i][k] = fabs(f) * NODE_SAMPLETIME;
+    }
+    if (freq) { phase[k] = n[k]->autophase; }
   }
 
-  /* write oscillator output */
-  for (int i = 0; i < NODE_BUFFER_SIZE; i++) {
-    float phase = clampf(n->phase.buf[i], 0.0, 1.0);
-    switch (n->mode) {
-      case PHASE : n->out.buf[i] = phase;                                   break;
-      case SINE  : n->out.buf[i] = sin(phase * 3.141592 * 2);               break;
-      case SAW   : n->out.buf[i] = 1.0 - 2.0 * phase;                       break;
-      case PULSE : n->out.buf[i] = phase < 0.5 ? -1.0 : 1.0;                break;
-      case NOISE : n->out.buf[i] = 1.0 - 2.0 * (rand() / (float) RAND_MAX); break;
+  for (int i = 0; i < len; i++) {
+    for (int k = 0; k < LANES; k++) {
+      phase[k] += step[i][k];
+      phase[k] -= floor(phase[k]);
     }
+    for (int k = 0; k < lanes; k++) { n[k]->phase.buf[i] = phase[k]; }
   }
 
-  /* send output */
-  node_process(node);
+  for (int k = 0; k < lanes; k++) {
+    n[k]->autophase = phase[k];
+    n[k]->phase.constant = false;
+  }
+}
+
+
+static void process_batch(Node **nodes, int count, int len) {
+  OscNode *n[LANES];
+  int lanes = 0;
+  for (int i = 0; i < count; i++) {
+    OscNode *node = (OscNode*) nodes[i];
+    if (node->phase.link_count > 0) { continue; }
+    n[lanes++] = node;
+    if (lanes == LANES) { update_phases(n, lanes, len); lanes = 0; }
+  }
+  if (lanes > 0) { update_phases(n, lanes, len); }
+
+  for (int i = 0; i < count; i++) {
+    write_output((OscNode*) nodes[i], len);
+  }
 }
 
 
@@ -63,8 +237,6 @@ static int receive(Node *node, const char *msg, char *err) {
 
 
 Node* new_osc_node(void) {
-  OscNode *node = calloc(1, sizeof(OscNode));
-
   static const char *inlets[] = { "phase", "freq", NULL };
   static const char *outlets[] = { "out", NULL };
 
@@ -76,13 +248,19 @@ Node* new_osc_node(void) {
 
   static NodeVtable vtable = {
     .process = process,
+    .process_batch = process_batch,
     .receive = receive,
     .free = node_free,
   };
 
+  OscNode *node = node_alloc(&info, sizeof(OscNode));
   node_init(&node->node, &info, &vtable, &node->phase, &node->out);
+  static uint32_t seed = 0x9e3779b9;
   node_set(&node->node, "freq", 440.0);
   node->mode = SINE;
+  for (int k = 0; k < NOISE_LANES; k++) {
+    node->seed[k] = seed += 0x6d2b79f5;
+  }
 
   return &node->node;
 }
@@ -7,32 +7,43 @@ enum { ROOMSIZE, DAMP, WET, DRY, WIDTH };
 typedef struct {
   Node node;
   fv_Context fv;
-  float buf[NODE_BUFFER_SIZE * 2];
+  int quiet, tail;
+  bool sleeping;
   NodePort inl, inr;   /* inlets */
   NodePort outl, outr; /* outlets */
+  float buf[]; /* the reverb's delay lines, pooled along with the node */
 } ReverbNode;
 
 
-static void process(Node *node) {
+static void process(Node *node, int len) {
   ReverbNode *n = (ReverbNode*) node;
 
-  /* copy inlets to buffer */
-  for (int i = 0; i < NODE_BUFFER_SIZE; i++) {
-    n->buf[i*2+0] = n->inl.buf[i];
-    n->buf[i*2+1] = n->inr.buf[i];
+  /* no input and the tail has been inaudible for longer than it takes to
+  ** pass through all of the comb and allpass buffers */
+  if (node_port_silent(&n->inl) && node_port_silent(&n->inr) && n->quiet >= n->tail) {
+    if (!n->sleeping) {
+      fv_mute(&n->fv);
+      n->sleeping = true;
+    }
+    node_port_set(&n->outl, 0);
+    node_port_set(&n->outr, 0);
+    return;
   }
 
-  /* process */
-  fv_process(&n->fv, n->buf, NODE_BUFFER_SIZE * 2);
+  n->sleeping = false;
 
-  /* copy buffer to outlets */
-  for (int i = 0; i < NODE_BUFFER_SIZE; i++) {
-    n->outl.buf[i] = n->buf[i*2+0];
-    n->outr.buf[i] = n->buf[i*2+1];
-  }
+  fv_process(&n->fv, n->inl.buf, n->inr.buf, n->outl.buf, n->outr.buf, len);
 
-  /* send output */
-  node_process(node);
+  bool quiet = true;
+  for (int i = 0; i < len; i++) {
+    if (fabs(n->outl.buf[i]) >= NODE_SILENCE) { quiet = false; }
+    if (fabs(n->outr.buf[i]) >= NODE_SILENCE) { quiet = false; }
+  }
+  if (!quiet) {
+    n->quiet = 0;
+  } else if (n->quiet < n->tail) {
+    n->quiet += len;
+  }
 }
 
 
@@ -60,8 +71,6 @@ static int receive(Node *node, const char *msg, char *err) {
 
 
 Node* new_reverb_node(void) {
-  ReverbNode *node = calloc(1, sizeof(ReverbNode));
-
   static const char *inlets[] = { "left", "right", NULL };
   static const char *outlets[] = { "left", "right", NULL };
 
@@ -77,9 +86,19 @@ Node* new_reverb_node(void) {
     .free = node_free,
   };
 
+  size_t size = sizeof(ReverbNode) + fv_buffer_size(NODE_SAMPLERATE) * sizeof(float);
+  ReverbNode *node = node_alloc(&info, size);
   node_init(&node->node, &info, &vtable, &node->inl, &node->outl);
-  fv_init(&node->fv);
-  fv_set_samplerate(&node->fv, NODE_SAMPLERATE);
+  fv_init(&node->fv, NODE_SAMPLERATE, node->buf);
+  fv_set_offset(&node->fv, NODE_DENORMAL_OFFSET);
+
+  /* longest path through the comb and allpass buffers */
+  for (int i = 0; i < FV_LANES; i++) {
+    node->tail = maxf(node->tail, node->fv.combs[i].bufsize);
+  }
+  for (int i = 0; i < FV_NUMALLPASSES; i++) {
+    node->tail += node->fv.allpassr[i].bufsize;
+  }
 
   return &node->node;
 }
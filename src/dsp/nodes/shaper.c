@@ -11,29 +11,46 @@ typedef struct {
 } ShaperNode;
 
 
-#define process_loop(f)                        \
-  for (int i = 0; i < NODE_BUFFER_SIZE; i++) { \
-    float in = n->in.buf[i] * n->gain.buf[i];  \
-    n->out.buf[i] = f(in);                     \
+#define process_loop(f)                          \
+  if (n->in.constant && n->gain.constant) {      \
+    float in = n->in.value * n->gain.value;      \
+    node_port_set(&n->out, f(in));               \
+  } else if (n->gain.constant) {                 \
+    float gain = n->gain.value;                  \
+    for (int i = 0; i < len; i++) {              \
+      float in = n->in.buf[i] * gain;            \
+      n->out.buf[i] = f(in);                     \
+    }                                            \
+  } else {                                       \
+    for (int i = 0; i < len; i++) {              \
+      float in = n->in.buf[i] * n->gain.buf[i];  \
+      n->out.buf[i] = f(in);                     \
+    }                                            \
   }
 
 #define softclip(in) (in / (1.0 + fabs(in)))
 #define hardclip(in) clampf(in, -1.0, 1.0)
-#define foldback(in) fabs(fabs(fmod(in - 1.0, 4.0)) - 2.0) - 1.0
+#define foldback(in) (fabs(fabs(fmod(in - 1.0, 4.0)) - 2.0) - 1.0)
 
-static void process(Node *node) {
+static void process(Node *node, int len) {
   ShaperNode *n = (ShaperNode*) node;
 
+  /* every mode maps zero to zero */
+  if (node_port_silent(&n->in) || node_port_silent(&n->gain)) {
+    node_port_set(&n->out, 0);
+    return;
+  }
+
   switch (n->mode) {
     case SOFTCLIP : process_loop(softclip); break;
     case HARDCLIP : process_loop(hardclip); break;
     case FOLDBACK : process_loop(foldback); break;
     case SINE     : process_loop(sin);      break;
-    case OFF      : memcpy(n->out.buf, n->in.buf, sizeof(n->out.buf)); break;
+    case OFF      : memcpy(n->out.buf, n->in.buf, sizeof(float) * len);
+                    n->out.constant = n->in.constant;
+                    n->out.value = n->in.value;
+                    break;
   }
-
-  /* send output */
-  node_process(node);
 }
 
 
@@ -54,8 +71,6 @@ static int receive(Node *node, const char *msg, char *err) {
 
 
 Node* new_shaper_node(void) {
-  ShaperNode *node = calloc(1, sizeof(ShaperNode));
-
   static const char *inlets[] = { "in", "gain", NULL };
   static const char *outlets[] = { "out", NULL };
 
@@ -71,6 +86,7 @@ Node* new_shaper_node(void) {
     .free = node_free,
   };
 
+  ShaperNode *node = node_alloc(&info, sizeof(ShaperNode));
   node_init(&node->node, &info, &vtable, &node->in, &node->out);
   node_set(&node->node, "gain", 1.0);
 
@@ -12,41 +12,155 @@ typedef struct {
 } SvfNode;
 
 
-static void process(Node *node) {
-  SvfNode *n = (SvfNode*) node;
-  const float passes = 3;
-  
+static const float passes = 3;
+
+
+static inline float freq_coef(float freq) {
   float max_freq = NODE_SAMPLERATE * 0.130 * passes;
-  float f1, q1, in, hp;
+  float f1 = minf(fabs(freq), max_freq) / passes;
+  return 2 * 3.141592 * f1 * NODE_SAMPLETIME;
+}
+
+
+static inline float q_coef(float q) {
+  return 1.0 / maxf(q, 0.5);
+}
+
+
+/* fills the block's coefficients; an inlet which holds still costs a single
+** evaluation, and the division for q is only done per sample if q moves */
+static void load_coefs(SvfNode *n, float *f1, float *q1, int len) {
+  if (n->freq.constant) {
+    float f = freq_coef(n->freq.value);
+    for (int i = 0; i < len; i++) { f1[i] = f; }
+  } else {
+    for (int i = 0; i < len; i++) { f1[i] = freq_coef(n->freq.buf[i]); }
+  }
+  if (n->q.constant) {
+    float q = q_coef(n->q.value);
+    for (int i = 0; i < len; i++) { q1[i] = q; }
+  } else {
+    for (int i = 0; i < len; i++) { q1[i] = q_coef(n->q.buf[i]); }
+  }
+}
+
+
+/* no input and the filter has rung out */
+static bool asleep(SvfNode *n) {
+  if (node_port_silent(&n->in) && fabs(n->d1) < NODE_SILENCE && fabs(n->d2) < NODE_SILENCE) {
+    n->d1 = n->d2 = 0;
+    node_port_set(&n->out, 0);
+    return true;
+  }
+  return false;
+}
+
+
+#define filter_loop(res)                            \
+  for (int i = 0; i < len; i++) {                   \
+    float in = n->in.buf[i], hp = 0;                \
+    for (int p = 0; p < passes; p++) {              \
+      lp = lp + f1[i] * bp;                         \
+      hp = in + offset - lp - q1[i] * bp;           \
+      bp = f1[i] * hp + bp;                         \
+    }                                               \
+    n->out.buf[i] = (res);                          \
+  }
+
+
+static void process(Node *node, int len) {
+  SvfNode *n = (SvfNode*) node;
+  if (asleep(n)) { return; }
+
+  float f1[NODE_MAX_BUFFER_SIZE], q1[NODE_MAX_BUFFER_SIZE];
+  load_coefs(n, f1, q1, len);
   float bp = n->d1;
   float lp = n->d2;
+  const float offset = NODE_DENORMAL_OFFSET;
+
+  switch (n->mode) {
+    case LOWPASS  : filter_loop(lp);      break;
+    case HIGHPASS : filter_loop(hp);      break;
+    case BANDPASS : filter_loop(bp);      break;
+    case NOTCH    : filter_loop(hp + lp); break;
+    case OFF      : filter_loop(in);      break;
+  }
+
+  n->d1 = bp;
+  n->d2 = lp;
+}
 
-  for (int i = 0; i < NODE_BUFFER_SIZE; i++) {
-    q1 = 1.0 / maxf(n->q.buf[i], 0.5);
-    f1 = minf(fabs(n->freq.buf[i]), max_freq) / passes;
-    f1 = 2 * 3.141592 * f1 * NODE_SAMPLETIME;
-    in = n->in.buf[i];
 
-    for (int i = 0; i < passes; i++) {
-      lp = lp + f1 * bp;
-      hp = in - lp - q1 * bp;
-      bp = f1 * hp + bp;
+/* filters in a batch are run LANES at a time with their inputs and state
+** laid out side by side, so the per-sample loop over lanes can be
+** vectorized; unused lanes are fed silence */
+#define LANES 8
+
+static void process_lanes(SvfNode **n, int lanes, int len) {
+  /* deterministic threads run batches on every worker */
+  static _Thread_local float in[NODE_MAX_BUFFER_SIZE][LANES];
+  static _Thread_local float f1[NODE_MAX_BUFFER_SIZE][LANES];
+  static _Thread_local float q1[NODE_MAX_BUFFER_SIZE][LANES];
+  static _Thread_local float out[NODE_MAX_BUFFER_SIZE][LANES];
+  float bp[LANES] = { 0 }, lp[LANES] = { 0 };
+  /* the mode picks out one of the filter's outputs by weighting */
+  float w_lp[LANES] = { 0 }, w_hp[LANES] = { 0 }, w_bp[LANES] = { 0 }, w_in[LANES] = { 0 };
+
+  for (int k = 0; k < LANES; k++) {
+    if (k >= lanes) {
+      for (int i = 0; i < len; i++) { in[i][k] = f1[i][k] = q1[i][k] = 0; }
+      continue;
     }
+    float f[NODE_MAX_BUFFER_SIZE], q[NODE_MAX_BUFFER_SIZE];
+    load_coefs(n[k], f, q, len);
+    for (int i = 0; i < len; i++) {
+      in[i][k] = n[k]->in.buf[i];
+      f1[i][k] = f[i];
+      q1[i][k] = q[i];
+    }
+    bp[k] = n[k]->d1;
+    lp[k] = n[k]->d2;
+    switch (n[k]->mode) {
+      case LOWPASS  : w_lp[k] = 1;           break;
+      case HIGHPASS : w_hp[k] = 1;           break;
+      case BANDPASS : w_bp[k] = 1;           break;
+      case NOTCH    : w_hp[k] = w_lp[k] = 1; break;
+      case OFF      : w_in[k] = 1;           break;
+    }
+  }
 
-    switch (n->mode) {
-      case LOWPASS  : n->out.buf[i] = lp;      break;
-      case HIGHPASS : n->out.buf[i] = hp;      break;
-      case BANDPASS : n->out.buf[i] = bp;      break;
-      case NOTCH    : n->out.buf[i] = hp + lp; break;
-      case OFF      : n->out.buf[i] = in;      break;
+  const float offset = NODE_DENORMAL_OFFSET;
+  for (int i = 0; i < len; i++) {
+    for (int k = 0; k < LANES; k++) {
+      float hp = 0;
+      for (int p = 0; p < passes; p++) {
+        lp[k] = lp[k] + f1[i][k] * bp[k];
+        hp = in[i][k] + offset - lp[k] - q1[i][k] * bp[k];
+        bp[k] = f1[i][k] * hp + bp[k];
+      }
+      out[i][k] = w_lp[k] * lp[k] + w_hp[k] * hp + w_bp[k] * bp[k] + w_in[k] * in[i][k];
     }
   }
 
-  n->d1 = bp;
-  n->d2 = lp;
+  for (int k = 0; k < lanes; k++) {
+    for (int i = 0; i < len; i++) { n[k]->out.buf[i] = out[i][k]; }
+    n[k]->d1 = bp[k];
+    n[k]->d2 = lp[k];
+  }
+}
+
 
-  /* send output */
-  node_process(node);
+static void process_batch(Node **nodes, int count, int len) {
+  SvfNode *n[LANES];
+  int lanes = 0;
+  for (int i = 0; i < count; i++) {
+    SvfNode *node = (SvfNode*) nodes[i];
+    if (asleep(node)) { continue; }
+    n[lanes++] = node;
+    if (lanes == LANES) { process_lanes(n, lanes, len); lanes = 0; }
+  }
+  if (lanes == 1) { process(&n[0]->node, len); }
+  else if (lanes > 1) { process_lanes(n, lanes, len); }
 }
 
 
@@ -67,8 +181,6 @@ static int receive(Node *node, const char *msg, char *err) {
 
 
 Node* new_svf_node(void) {
-  SvfNode *node = calloc(1, sizeof(SvfNode));
-
   static const char *inlets[] = { "in", "freq", "q", NULL };
   static const char *outlets[] = { "out", NULL };
 
@@ -80,10 +192,12 @@ Node* new_svf_node(void) {
 
   static NodeVtable vtable = {
     .process = process,
+    .process_batch = process_batch,
     .receive = receive,
     .free = node_free,
   };
 
+  SvfNode *node = node_alloc(&info, sizeof(SvfNode));
   node_init(&node->node, &info, &vtable, &node->in, &node->out);
   node_set(&node->node, "freq", 440.0);
   node_set(&node->node, "q", 1.0);
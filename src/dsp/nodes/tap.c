@@ -0,0 +1,43 @@
+#include "../node.h"
+
+
+/* a sink which passes its input through unheard: whatever feeds it keeps
+** being processed, and its outlet can be read by scopes and dsp:get */
+typedef struct {
+  Node node;
+  NodePort in;  /* inlets */
+  NodePort out; /* outlets */
+} TapNode;
+
+
+static void process(Node *node, int len) {
+  TapNode *n = (TapNode*) node;
+  if (n->in.constant) {
+    node_port_set(&n->out, n->in.value);
+  } else {
+    memcpy(n->out.buf, n->in.buf, sizeof(float) * len);
+  }
+}
+
+
+Node* new_tap_node(void) {
+  static const char *inlets[] = { "in", NULL };
+  static const char *outlets[] = { "out", NULL };
+
+  static NodeInfo info = {
+    .name = "tap",
+    .inlets = inlets,
+    .outlets = outlets,
+    .sink = true,
+  };
+
+  static NodeVtable vtable = {
+    .process = process,
+    .receive = node_receive,
+    .free = node_free,
+  };
+
+  TapNode *node = node_alloc(&info, sizeof(TapNode));
+  node_init(&node->node, &info, &vtable, &node->in, &node->out);
+  return &node->node;
+}
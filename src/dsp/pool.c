@@ -0,0 +1,274 @@
+#include <SDL2/SDL.h>
+#include "pool.h"
+
+#define DEQUE_SIZE 65536
+#define DEQUE_MASK (DEQUE_SIZE - 1)
+#define SPIN_COUNT 20000
+
+/* Chase-Lev work-stealing deque: the owning thread pushes and takes at the
+** bottom, other threads steal from the top */
+typedef struct {
+  _Atomic(Node*) *buf;
+  atomic_long top, bottom;
+} Deque;
+
+typedef struct {
+  SDL_Thread *thread;
+  SDL_sem *sem;
+  atomic_bool parked;
+  unsigned last_gate; /* gate of the last block seen */
+  Deque deque;
+  uint32_t seed;
+} Worker;
+
+/* the audio thread is worker 0 */
+static Worker workers[POOL_MAX_THREADS];
+static int spawned = 1;
+static PoolProcessFn process_fn;
+static PoolRunFn run_fn;
+
+/* `gate` is odd while no block is running and even while one is; workers
+** count themselves in `busy` for as long as they may touch `job` */
+static atomic_uint gate = 1;
+static atomic_int busy;
+
+static struct {
+  PoolPlan *plan;
+  int len;
+  int threads;
+  bool deterministic;
+  atomic_int next_root;
+  atomic_int remaining;
+  atomic_int barrier;
+} job;
+
+
+static inline void cpu_relax(int *spins) {
+  if (++*spins % 1024 == 0) {
+    SDL_Delay(0);
+  } else {
+#if defined(__i386__) || defined(__x86_64__)
+    __builtin_ia32_pause();
+#endif
+  }
+}
+
+
+static void deque_push(Deque *d, Node *node) {
+  long b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+  atomic_store_explicit(&d->buf[b & DEQUE_MASK], node, memory_order_relaxed);
+  atomic_store_explicit(&d->bottom, b + 1, memory_order_release);
+}
+
+
+static Node* deque_take(Deque *d) {
+  long b = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+  atomic_store_explicit(&d->bottom, b, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  long t = atomic_load_explicit(&d->top, memory_order_relaxed);
+  Node *node = NULL;
+  if (t <= b) {
+    node = atomic_load_explicit(&d->buf[b & DEQUE_MASK], memory_order_relaxed);
+    if (t == b) {
+      /* last item: race any thieves for it */
+      if (!atomic_compare_exchange_strong(&d->top, &t, t + 1)) { node = NULL; }
+      atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    }
+  } else {
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+  }
+  return node;
+}
+
+
+static Node* deque_steal(Deque *d) {
+  long t = atomic_load_explicit(&d->top, memory_order_acquire);
+  atomic_thread_fence(memory_order_seq_cst);
+  long b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+  if (t >= b) { return NULL; }
+  Node *node = atomic_load_explicit(&d->buf[t & DEQUE_MASK], memory_order_relaxed);
+  if (!atomic_compare_exchange_strong(&d->top, &t, t + 1)) { return NULL; }
+  return node;
+}
+
+
+static Node* find_task(Worker *w) {
+  Node *node = deque_take(&w->deque);
+  if (node) { return node; }
+
+  int idx = atomic_fetch_add(&job.next_root, 1);
+  if (idx < job.plan->root_count) { return job.plan->roots[idx]; }
+
+  /* steal from a random worker */
+  w->seed = w->seed * 1664525 + 1013904223;
+  int start = (w->seed >> 16) % job.threads;
+  for (int i = 0; i < job.threads; i++) {
+    Worker *victim = &workers[(start + i) % job.threads];
+    if (victim == w) { continue; }
+    node = deque_steal(&victim->deque);
+    if (node) { return node; }
+  }
+  return NULL;
+}
+
+
+/* nodes are taken one at a time as their dependencies finish, so unlike the
+** serial and deterministic paths this one never batches them */
+static void run_task(Worker *w, Node *node) {
+  process_fn(node, job.len);
+
+  /* queue nodes whose last dependency this was. Nodes outside the plan
+  ** still carry the order and count of an older one, so they are skipped */
+  for (int j = 0; node->info->outlets[j]; j++) {
+    NodePort *outlet = &node->outlets[j];
+    for (int i = 0; i < outlet->link_count; i++) {
+      Node *next = outlet->links[i].node;
+      if (next->mark != job.plan->mark || next->order <= node->order) { continue; }
+      if (atomic_fetch_sub(&next->pending, 1) == 1) {
+        deque_push(&w->deque, next);
+      }
+    }
+  }
+
+  atomic_fetch_sub(&job.remaining, 1);
+}
+
+
+static void run_stealing(Worker *w) {
+  int spins = 0;
+  while (atomic_load(&job.remaining) > 0) {
+    Node *node = find_task(w);
+    if (node) {
+      run_task(w, node);
+    } else {
+      cpu_relax(&spins);
+    }
+  }
+}
+
+
+static void run_deterministic(int idx) {
+  /* each worker takes a fixed slice of every level and waits for all other
+  ** workers to finish the level before moving to the next. Same-typed nodes
+  ** are adjacent within a level, so a slice is processed in batches */
+  PoolPlan *plan = job.plan;
+  int n = job.threads;
+  for (int l = 0; l < plan->level_count; l++) {
+    int start = plan->level_start[l];
+    int count = plan->level_start[l + 1] - start;
+    int from = start + count * idx / n;
+    int to = start + count * (idx + 1) / n;
+    for (int i = from; i < to;) {
+      i += run_fn(&plan->levels[i], to - i, job.len);
+    }
+    int spins = 0;
+    atomic_fetch_add(&job.barrier, 1);
+    while (atomic_load(&job.barrier) < n * (l + 1)) { cpu_relax(&spins); }
+  }
+}
+
+
+static int worker_thread(void *udata) {
+  Worker *w = udata;
+  int idx = w - workers;
+  unsigned last = w->last_gate;
+  SDL_SetThreadPriority(SDL_THREAD_PRIORITY_HIGH);
+  node_flush_denormals();
+
+  for (;;) {
+    /* spin briefly waiting for the next block, then park */
+    int spins = 0;
+    unsigned g;
+    while ((g = atomic_load(&gate)) == last || (g & 1)) {
+      if (spins < SPIN_COUNT) { cpu_relax(&spins); continue; }
+      atomic_store(&w->parked, true);
+      g = atomic_load(&gate);
+      if ((g == last || (g & 1)) || !atomic_exchange(&w->parked, false)) {
+        SDL_SemWait(w->sem);
+      }
+      spins = 0;
+    }
+
+    /* join the block unless it closed while we weren't looking */
+    atomic_fetch_add(&busy, 1);
+    if (atomic_load(&gate) == g) {
+      if (idx < job.threads) {
+        if (job.deterministic) {
+          run_deterministic(idx);
+        } else {
+          run_stealing(w);
+        }
+      }
+      last = g;
+    }
+    atomic_fetch_sub(&busy, 1);
+  }
+
+  return 0;
+}
+
+
+static void init_worker(Worker *w, int idx) {
+  w->deque.buf = calloc(DEQUE_SIZE, sizeof(*w->deque.buf));
+  expect(w->deque.buf);
+  w->sem = SDL_CreateSemaphore(0);
+  w->seed = idx + 1;
+}
+
+
+void pool_init(PoolProcessFn fn, PoolRunFn rfn) {
+  process_fn = fn;
+  run_fn = rfn;
+  init_worker(&workers[0], 0);
+}
+
+
+void pool_spawn(int threads) {
+  expect(threads <= POOL_MAX_THREADS);
+  for (; spawned < threads; spawned++) {
+    Worker *w = &workers[spawned];
+    init_worker(w, spawned);
+    /* the thread may not start running until well into a later block; it
+    ** must not mistake that block for one it has already seen, as in
+    ** deterministic mode the others would wait for it forever */
+    w->last_gate = atomic_load(&gate);
+    w->thread = SDL_CreateThread(worker_thread, "DSP Worker", w);
+    expect(w->thread);
+  }
+}
+
+
+void pool_process(PoolPlan *plan, int len, int threads, bool deterministic) {
+  expect(plan->count <= DEQUE_SIZE);
+  int spins = 0;
+
+  /* wait for workers that joined the previous block late to leave it */
+  while (atomic_load(&busy) > 0) { cpu_relax(&spins); }
+
+  for (int i = 0; i < plan->count; i++) {
+    atomic_store_explicit(&plan->nodes[i]->pending, plan->nodes[i]->deps, memory_order_relaxed);
+  }
+  job.plan = plan;
+  job.len = len;
+  job.threads = threads;
+  job.deterministic = deterministic;
+  atomic_store(&job.next_root, 0);
+  atomic_store(&job.remaining, plan->count);
+  atomic_store(&job.barrier, 0);
+
+  /* open the block and wake parked workers */
+  atomic_fetch_add(&gate, 1);
+  for (int i = 1; i < threads; i++) {
+    if (atomic_exchange(&workers[i].parked, false)) {
+      SDL_SemPost(workers[i].sem);
+    }
+  }
+
+  if (deterministic) {
+    run_deterministic(0);
+  } else {
+    run_stealing(&workers[0]);
+  }
+
+  atomic_fetch_add(&gate, 1);
+}
@@ -0,0 +1,24 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include "node.h"
+
+#define POOL_MAX_THREADS 64
+
+typedef void (*PoolProcessFn)(Node *node, int len);
+/* processes the leading nodes of `nodes` sharing a type together where the
+** type can batch them, returning how many of the `count` it processed */
+typedef int (*PoolRunFn)(Node **nodes, int count, int len);
+
+typedef struct {
+  Node **nodes;  int count;      /* all nodes in topological order */
+  Node **roots;  int root_count; /* nodes not depending on any other node */
+  Node **levels; int *level_start; int level_count; /* nodes by dependency level */
+  int mark; /* `Node.mark` of the plan's nodes; others may link from them */
+} PoolPlan;
+
+void pool_init(PoolProcessFn fn, PoolRunFn rfn);
+void pool_spawn(int threads);
+void pool_process(PoolPlan *plan, int len, int threads, bool deterministic);
+
+#endif
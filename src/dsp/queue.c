@@ -0,0 +1,72 @@
+#include "queue.h"
+
+
+void queue_init(Queue *q, int item_size, int capacity) {
+  expect((capacity & (capacity - 1)) == 0);
+  q->items = calloc(capacity, item_size);
+  expect(q->items);
+  q->item_size = item_size;
+  q->mask = capacity - 1;
+  atomic_init(&q->head, 0);
+  atomic_init(&q->tail, 0);
+}
+
+
+bool queue_push(Queue *q, const void *item) {
+  unsigned tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+  unsigned head = atomic_load_explicit(&q->head, memory_order_acquire);
+  if (tail - head > q->mask) { return false; }
+  memcpy(q->items + (tail & q->mask) * q->item_size, item, q->item_size);
+  atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+  return true;
+}
+
+
+bool queue_pop(Queue *q, void *item) {
+  unsigned head = atomic_load_explicit(&q->head, memory_order_relaxed);
+  unsigned tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+  if (head == tail) { return false; }
+  memcpy(item, q->items + (head & q->mask) * q->item_size, q->item_size);
+  atomic_store_explicit(&q->head, head + 1, memory_order_release);
+  return true;
+}
+
+
+bool queue_full(Queue *q) {
+  unsigned tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+  unsigned head = atomic_load_explicit(&q->head, memory_order_acquire);
+  return tail - head > q->mask;
+}
+
+
+/* bulk variants of push and pop: copy as many of the `n` items as fit in
+** at most two memcpys and return how many were copied */
+int queue_write(Queue *q, const void *items, int n) {
+  unsigned tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+  unsigned head = atomic_load_explicit(&q->head, memory_order_acquire);
+  unsigned space = q->mask + 1 - (tail - head);
+  if ((unsigned) n > space) { n = space; }
+  unsigned idx = tail & q->mask;
+  unsigned first = q->mask + 1 - idx;
+  if (first > (unsigned) n) { first = n; }
+  memcpy(q->items + idx * q->item_size, items, first * q->item_size);
+  memcpy(q->items, (const char*) items + first * q->item_size,
+         (n - first) * q->item_size);
+  atomic_store_explicit(&q->tail, tail + n, memory_order_release);
+  return n;
+}
+
+
+int queue_read(Queue *q, void *items, int n) {
+  unsigned head = atomic_load_explicit(&q->head, memory_order_relaxed);
+  unsigned tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+  if ((unsigned) n > tail - head) { n = tail - head; }
+  unsigned idx = head & q->mask;
+  unsigned first = q->mask + 1 - idx;
+  if (first > (unsigned) n) { first = n; }
+  memcpy(items, q->items + idx * q->item_size, first * q->item_size);
+  memcpy((char*) items + first * q->item_size, q->items,
+         (n - first) * q->item_size);
+  atomic_store_explicit(&q->head, head + n, memory_order_release);
+  return n;
+}
@@ -0,0 +1,23 @@
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <stdatomic.h>
+#include "common.h"
+
+/* bounded single-producer/single-consumer queue of fixed-size items: one
+** thread may push while another pops without either of them blocking */
+typedef struct {
+  char *items;
+  int item_size;
+  unsigned mask;
+  atomic_uint head, tail;
+} Queue;
+
+void queue_init(Queue *q, int item_size, int capacity);
+bool queue_push(Queue *q, const void *item);
+bool queue_pop(Queue *q, void *item);
+bool queue_full(Queue *q);
+int queue_write(Queue *q, const void *items, int n);
+int queue_read(Queue *q, void *items, int n);
+
+#endif
@@ -0,0 +1,185 @@
+#include <SDL2/SDL.h>
+#include <stdatomic.h>
+#include "queue.h"
+#include "wav.h"
+#include "stream.h"
+
+/* about 6 seconds at 44.1khz */
+#define BUFFER_FRAMES  (1 << 18)
+#define CHUNK_SAMPLES  8192
+#define WRITE_INTERVAL 10
+
+enum { IDLE, OPENING, RECORDING, CLOSING };
+
+struct Stream {
+  Stream *next;
+  Queue frames;
+  WavFile wav;
+  int channels;
+  bool failed;
+  atomic_int state;
+  atomic_int dropped;
+  /* set by whoever moves the stream to OPENING */
+  char filename[STREAM_MAX_FILENAME];
+  int samplerate, bits;
+};
+
+static SDL_mutex *lock;
+static Stream *streams;
+
+
+/* moves everything currently queued into the file, or discards it if no
+** file is open; must be called with the lock held */
+static void drain(Stream *s) {
+  static float buf[CHUNK_SAMPLES];
+  int n;
+  while ((n = queue_read(&s->frames, buf, CHUNK_SAMPLES / s->channels)) > 0) {
+    if (s->wav.fp && !s->failed && wav_write(&s->wav, buf, n)) {
+      s->failed = true;
+    }
+  }
+}
+
+
+static int close_file(Stream *s);
+
+static int open_file(Stream *s) {
+  /* drop anything left from a block which was being written as the last
+  ** recording was closed */
+  drain(s);
+  s->failed = false;
+  int err = wav_open(&s->wav, s->filename, s->samplerate, s->channels, s->bits);
+  if (err && s->wav.fp) { fclose(s->wav.fp); }
+  if (err) { s->wav.fp = NULL; }
+  atomic_store(&s->dropped, 0);
+  if (err) {
+    atomic_store(&s->state, IDLE);
+    return err;
+  }
+  /* a close requested while the file was being opened closes it now */
+  int state = OPENING;
+  if (!atomic_compare_exchange_strong(&s->state, &state, RECORDING)) {
+    close_file(s);
+  }
+  return 0;
+}
+
+
+static int close_file(Stream *s) {
+  atomic_store(&s->state, CLOSING);
+  drain(s);
+  int err = 0;
+  if (s->wav.fp) {
+    err = wav_close(&s->wav);
+    if (s->failed) { err = -1; }
+  }
+  atomic_store(&s->state, IDLE);
+  return err;
+}
+
+
+static int writer_thread(void *udata) {
+  for (;;) {
+    SDL_Delay(WRITE_INTERVAL);
+    SDL_LockMutex(lock);
+    for (Stream *s = streams; s; s = s->next) {
+      switch (atomic_load(&s->state)) {
+        case OPENING : open_file(s);  break;
+        case CLOSING : close_file(s); break;
+        default      : drain(s);      break;
+      }
+    }
+    SDL_UnlockMutex(lock);
+  }
+  return 0;
+}
+
+
+void stream_init(void) {
+  lock = SDL_CreateMutex();
+  SDL_Thread *thread = SDL_CreateThread(writer_thread, "stream", NULL);
+  expect(thread);
+  SDL_DetachThread(thread);
+}
+
+
+Stream* stream_new(int channels) {
+  Stream *s = calloc(1, sizeof(*s));
+  expect(s);
+  s->channels = channels;
+  queue_init(&s->frames, sizeof(float) * channels, BUFFER_FRAMES);
+  SDL_LockMutex(lock);
+  s->next = streams;
+  streams = s;
+  SDL_UnlockMutex(lock);
+  return s;
+}
+
+
+void stream_free(Stream *s) {
+  SDL_LockMutex(lock);
+  close_file(s);
+  Stream **p = &streams;
+  while (*p != s) { p = &(*p)->next; }
+  *p = s->next;
+  SDL_UnlockMutex(lock);
+  free(s->frames.items);
+  free(s);
+}
+
+
+int stream_open(Stream *s, const char *filename, int samplerate, int bits) {
+  SDL_LockMutex(lock);
+  if (s->wav.fp) { close_file(s); }
+  snprintf(s->filename, sizeof(s->filename), "%s", filename);
+  s->samplerate = samplerate;
+  s->bits = bits;
+  atomic_store(&s->state, OPENING);
+  int err = open_file(s);
+  SDL_UnlockMutex(lock);
+  return err;
+}
+
+
+int stream_close(Stream *s) {
+  SDL_LockMutex(lock);
+  int err = close_file(s);
+  SDL_UnlockMutex(lock);
+  return err;
+}
+
+
+bool stream_request_open(Stream *s, const char *filename, int samplerate, int bits) {
+  if (atomic_load(&s->state) != IDLE) { return false; }
+  snprintf(s->filename, sizeof(s->filename), "%s", filename);
+  s->samplerate = samplerate;
+  s->bits = bits;
+  atomic_store(&s->state, OPENING);
+  return true;
+}
+
+
+/* a stream still waiting to be opened is closed as soon as it is; returns
+** false if there was nothing to close */
+bool stream_request_close(Stream *s) {
+  int state = RECORDING;
+  if (atomic_compare_exchange_strong(&s->state, &state, CLOSING)) { return true; }
+  state = OPENING;
+  return atomic_compare_exchange_strong(&s->state, &state, CLOSING);
+}
+
+
+void stream_write(Stream *s, const float *buf, int n) {
+  if (atomic_load_explicit(&s->state, memory_order_relaxed) != RECORDING) {
+    return;
+  }
+  int written = queue_write(&s->frames, buf, n);
+  if (written < n) {
+    atomic_fetch_add_explicit(&s->dropped, n - written, memory_order_relaxed);
+  }
+}
+
+
+int stream_dropped(Stream *s) {
+  return atomic_load(&s->dropped);
+}
@@ -0,0 +1,25 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include "common.h"
+
+#define STREAM_MAX_FILENAME 256
+
+/* records interleaved frames to a file. The audio thread only copies frames
+** into a stream's ring buffer; a writer thread shared by all streams drains
+** them and does the file io. Streams are opened and closed either blocking,
+** from the main thread, or by request from the audio thread, in which case
+** the writer thread carries the request out */
+typedef struct Stream Stream;
+
+void stream_init(void);
+Stream* stream_new(int channels);
+void stream_free(Stream *s);
+int stream_open(Stream *s, const char *filename, int samplerate, int bits);
+int stream_close(Stream *s);
+bool stream_request_open(Stream *s, const char *filename, int samplerate, int bits);
+bool stream_request_close(Stream *s);
+void stream_write(Stream *s, const float *buf, int frames);
+int stream_dropped(Stream *s);
+
+#endif
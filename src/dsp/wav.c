@@ -0,0 +1,140 @@
+#include <math.h>
+#include "wav.h"
+
+/* RIFF header, JUNK chunk (replaced by ds64 for RF64), fmt chunk and the
+** data chunk's header */
+#define HEADER_SIZE 80
+#define DS64_SIZE   28
+#define FORMAT_PCM   1
+#define FORMAT_FLOAT 3
+
+
+static void put16(uint8_t *p, uint16_t n) {
+  p[0] = n; p[1] = n >> 8;
+}
+
+
+static void put32(uint8_t *p, uint32_t n) {
+  p[0] = n; p[1] = n >> 8; p[2] = n >> 16; p[3] = n >> 24;
+}
+
+
+static void put64(uint8_t *p, uint64_t n) {
+  put32(p, n); put32(p + 4, n >> 32);
+}
+
+
+static int frame_size(WavFile *wav) {
+  return wav->channels * wav->bits / 8;
+}
+
+
+static int write_header(WavFile *wav) {
+  uint8_t h[HEADER_SIZE] = { 0 };
+  uint64_t data_size = wav->frames * frame_size(wav);
+  uint64_t riff_size = data_size + (data_size & 1) + HEADER_SIZE - 8;
+  bool rf64 = riff_size > UINT32_MAX;
+
+  memcpy(h +  0, rf64 ? "RF64" : "RIFF", 4);
+  put32(h + 4, rf64 ? UINT32_MAX : riff_size);
+  memcpy(h +  8, "WAVE", 4);
+
+  /* reserve room for a ds64 chunk so a file can become RF64 in place */
+  memcpy(h + 12, rf64 ? "ds64" : "JUNK", 4); put32(h + 16, DS64_SIZE);
+  if (rf64) {
+    put64(h + 20, riff_size);
+    put64(h + 28, data_size);
+    put64(h + 36, wav->frames);
+  }
+
+  memcpy(h + 48, "fmt ", 4); put32(h + 52, 16);
+  put16(h + 56, wav->bits == 32 ? FORMAT_FLOAT : FORMAT_PCM);
+  put16(h + 58, wav->channels);
+  put32(h + 60, wav->samplerate);
+  put32(h + 64, wav->samplerate * frame_size(wav));
+  put16(h + 68, frame_size(wav));
+  put16(h + 70, wav->bits);
+  memcpy(h + 72, "data", 4); put32(h + 76, rf64 ? UINT32_MAX : data_size);
+
+  if (fseek(wav->fp, 0, SEEK_SET)) { return -1; }
+  return fwrite(h, sizeof(h), 1, wav->fp) == 1 ? 0 : -1;
+}
+
+
+int wav_open(WavFile *wav, const char *filename, int samplerate, int channels, int bits) {
+  memset(wav, 0, sizeof(*wav));
+  if (bits != 16 && bits != 24 && bits != 32) { return -1; }
+  wav->samplerate = samplerate;
+  wav->channels = channels;
+  wav->bits = bits;
+  wav->seed = 0x9e3779b9;
+  int len = strlen(filename);
+  wav->raw = len < 4 || !string_equal_nocase(filename + len - 4, ".wav");
+  wav->fp = fopen(filename, "wb");
+  if (!wav->fp) { return -1; }
+  if (wav->raw) { return 0; }
+  /* sizes are left as zero until the file is closed */
+  return write_header(wav);
+}
+
+
+/* triangular dither of +-1 lsb, the difference of two uniform values */
+static inline float dither(WavFile *wav) {
+  float r[2];
+  for (int i = 0; i < 2; i++) {
+    wav->seed ^= wav->seed << 13;
+    wav->seed ^= wav->seed >> 17;
+    wav->seed ^= wav->seed << 5;
+    r[i] = wav->seed / (float) UINT32_MAX;
+  }
+  return r[0] - r[1];
+}
+
+
+static inline int32_t quantize(WavFile *wav, float x, float scale) {
+  float n = clampf(x * scale + dither(wav), -scale - 1, scale);
+  return lrintf(n);
+}
+
+
+int wav_write(WavFile *wav, const float *buf, int frames) {
+  if (wav->bits == 32) {
+    int n = fwrite(buf, sizeof(float) * wav->channels, frames, wav->fp);
+    wav->frames += n;
+    return n == frames ? 0 : -1;
+  }
+
+  /* convert and write in chunks */
+  uint8_t out[4096 * 3];
+  int bytes = wav->bits / 8;
+  int total = frames * wav->channels;
+  for (int i = 0; i < total;) {
+    int n = total - i;
+    if (n > (int) sizeof(out) / 3) { n = sizeof(out) / 3; }
+    for (int j = 0; j < n; j++) {
+      if (bytes == 2) {
+        put16(out + j * 2, quantize(wav, buf[i + j], 32767));
+      } else {
+        int32_t s = quantize(wav, buf[i + j], 8388607);
+        out[j*3+0] = s; out[j*3+1] = s >> 8; out[j*3+2] = s >> 16;
+      }
+    }
+    if (fwrite(out, bytes, n, wav->fp) != n) { return -1; }
+    i += n;
+  }
+  wav->frames += frames;
+  return 0;
+}
+
+
+int wav_close(WavFile *wav) {
+  int err = 0;
+  if (!wav->raw) {
+    /* chunks must have an even size */
+    if (wav->frames * frame_size(wav) & 1) { fputc(0, wav->fp); }
+    err = write_header(wav);
+  }
+  if (fclose(wav->fp)) { err = -1; }
+  wav->fp = NULL;
+  return err;
+}
@@ -0,0 +1,23 @@
+#ifndef WAV_H
+#define WAV_H
+
+#include "common.h"
+
+/* writes interleaved float frames as 16 or 24 bit dithered integers or as
+** 32 bit floats. Files not ending in ".wav" are written as raw samples with
+** no header; wav files switch to RF64 once they outgrow 4gb */
+typedef struct {
+  FILE *fp;
+  int samplerate;
+  int channels;
+  int bits;
+  bool raw;
+  uint32_t seed;
+  uint64_t frames;
+} WavFile;
+
+int wav_open(WavFile *wav, const char *filename, int samplerate, int channels, int bits);
+int wav_write(WavFile *wav, const float *buf, int frames);
+int wav_close(WavFile *wav);
+
+#endif
@@ -1,12 +1,9 @@
 #include "freeverb.h"
+#include <stddef.h>
 
 
-#define undenormalize(n) { if (xabs(n) < 1e-37) { (n) = 0; } }
-
-
-static inline float xabs(float n) {
-  return n < 0 ? -n : n;
-}
+static const int comb_tuning[] = { 1116, 1188, 1277, 1356, 1422, 1491, 1557, 1617 };
+static const int allpass_tuning[] = { 556, 441, 341, 225 };
 
 
 static inline void zeroset(void *buf, int n) {
@@ -14,70 +11,63 @@ static inline void zeroset(void *buf, int n) {
 }
 
 
-static inline float allpass_process(fv_Allpass *ap, float input) {
-  float bufout = ap->buf[ap->bufidx];
-  undenormalize(bufout);
-
-  float output = -input + bufout;
-  ap->buf[ap->bufidx] = input + bufout * ap->feedback;
-
-  if (++ap->bufidx >= ap->bufsize) {
-    ap->bufidx = 0;
-  }
-
-  return output;
+/* copies the next `n` samples due out of the line, `n` being no more than
+** the line's size */
+static void line_read(fv_Line *l, float *dst, int n) {
+  int first = l->bufsize - l->bufidx;
+  if (first > n) { first = n; }
+  for (int i = 0; i < first; i++) { dst[i] = l->buf[l->bufidx + i]; }
+  for (int i = first; i < n; i++) { dst[i] = l->buf[i - first]; }
 }
 
 
-static inline float comb_process(fv_Comb *cmb, float input) {
-  float output = cmb->buf[cmb->bufidx];
-  undenormalize(output);
-
-  cmb->filterstore = output * cmb->damp2 + cmb->filterstore * cmb->damp1;
-  undenormalize(cmb->filterstore);
-
-  cmb->buf[cmb->bufidx] = input + cmb->filterstore * cmb->feedback;
-
-  if (++cmb->bufidx >= cmb->bufsize) {
-    cmb->bufidx = 0;
-  }
-
-  return output;
-}
-
-
-static inline void comb_set_damp(fv_Comb *cmb, float n) {
-  cmb->damp1 = n;
-  cmb->damp2 = 1.0 - n;
+/* replaces the samples just read and moves the line on */
+static void line_write(fv_Line *l, const float *src, int n) {
+  int first = l->bufsize - l->bufidx;
+  if (first > n) { first = n; }
+  for (int i = 0; i < first; i++) { l->buf[l->bufidx + i] = src[i]; }
+  for (int i = first; i < n; i++) { l->buf[i - first] = src[i]; }
+  l->bufidx = (l->bufidx + n) % l->bufsize;
 }
 
 
-void fv_init(fv_Context *ctx) {
-  zeroset(ctx, sizeof(*ctx));
+/* gives each line its place in `buf`, or only counts if `buf` is NULL */
+static int layout(fv_Context *ctx, float samplerate, float *buf) {
+  double multiplier = samplerate / FV_INITIALSR;
+  fv_Line *lines[FV_LANES + FV_NUMALLPASSES * 2];
+  int sizes[FV_LANES + FV_NUMALLPASSES * 2];
+  int count = 0;
 
+  for (int i = 0; i < FV_NUMCOMBS; i++) {
+    lines[count] = &ctx->combs[i];
+    sizes[count++] = comb_tuning[i] * multiplier;
+    lines[count] = &ctx->combs[FV_NUMCOMBS + i];
+    sizes[count++] = (comb_tuning[i] + FV_STEREOSPREAD) * multiplier;
+  }
   for (int i = 0; i < FV_NUMALLPASSES; i++) {
-    ctx->allpassl[i].feedback = 0.5;
-    ctx->allpassr[i].feedback = 0.5;
+    lines[count] = &ctx->allpassl[i];
+    sizes[count++] = allpass_tuning[i] * multiplier;
+    lines[count] = &ctx->allpassr[i];
+    sizes[count++] = (allpass_tuning[i] + FV_STEREOSPREAD) * multiplier;
   }
 
-  fv_set_samplerate(ctx, FV_INITIALSR);
-  fv_set_wet(ctx, FV_INITIALWET);
-  fv_set_roomsize(ctx, FV_INITIALROOM);
-  fv_set_dry(ctx, FV_INITIALDRY);
-  fv_set_damp(ctx, FV_INITIALDAMP);
-  fv_set_width(ctx, FV_INITIALWIDTH);
+  int total = 0;
+  for (int i = 0; i < count; i++) {
+    int size = sizes[i] < 1 ? 1 : sizes[i];
+    if (buf) {
+      lines[i]->buf = buf + total;
+      lines[i]->bufsize = size;
+      lines[i]->bufidx = 0;
+    }
+    total += size;
+  }
+  return total;
 }
 
 
-void fv_mute(fv_Context *ctx) {
-  for (int i = 0; i < FV_NUMCOMBS; i++) {
-    zeroset(ctx->combl[i].buf, sizeof(ctx->combl[i].buf));
-    zeroset(ctx->combr[i].buf, sizeof(ctx->combr[i].buf));
-  }
-  for (int i = 0; i < FV_NUMALLPASSES; i++) {
-    zeroset(ctx->allpassl[i].buf, sizeof(ctx->allpassl[i].buf));
-    zeroset(ctx->allpassr[i].buf, sizeof(ctx->allpassr[i].buf));
-  }
+int fv_buffer_size(float samplerate) {
+  fv_Context ctx;
+  return layout(&ctx, samplerate, NULL);
 }
 
 
@@ -95,33 +85,32 @@ static void update(fv_Context *ctx) {
     ctx->damp1 = ctx->damp;
     ctx->gain = FV_FIXEDGAIN;
   }
-
-  for (int i = 0; i < FV_NUMCOMBS; i++) {
-    ctx->combl[i].feedback = ctx->roomsize1;
-    ctx->combr[i].feedback = ctx->roomsize1;
-    comb_set_damp(&ctx->combl[i], ctx->damp1);
-    comb_set_damp(&ctx->combr[i], ctx->damp1);
-  }
 }
 
 
-void fv_set_samplerate(fv_Context *ctx, float value) {
-  const int combs[] = { 1116, 1188, 1277, 1356, 1422, 1491, 1557, 1617 };
-  const int allpasses[] = { 556, 441, 341, 225 };
+/* `buf` holds `fv_buffer_size()` zeroed floats and is kept by the context */
+void fv_init(fv_Context *ctx, float samplerate, float *buf) {
+  zeroset(ctx, sizeof(*ctx));
+  layout(ctx, samplerate, buf);
 
-  double multiplier = value / FV_INITIALSR;
+  fv_set_wet(ctx, FV_INITIALWET);
+  fv_set_roomsize(ctx, FV_INITIALROOM);
+  fv_set_dry(ctx, FV_INITIALDRY);
+  fv_set_damp(ctx, FV_INITIALDAMP);
+  fv_set_width(ctx, FV_INITIALWIDTH);
+}
 
-  /* init comb buffers */
-  for (int i = 0; i < FV_NUMCOMBS; i++) {
-    ctx->combl[i].bufsize = combs[i] * multiplier;
-    ctx->combr[i].bufsize = (combs[i] + FV_STEREOSPREAD) * multiplier;
-  }
 
-  /* init allpass buffers */
+void fv_mute(fv_Context *ctx) {
+  /* the lines sit one after another in the caller's buffer */
+  float *buf = ctx->combs[0].buf;
+  int total = 0;
+  for (int i = 0; i < FV_LANES; i++) { total += ctx->combs[i].bufsize; }
   for (int i = 0; i < FV_NUMALLPASSES; i++) {
-    ctx->allpassl[i].bufsize = allpasses[i] * multiplier;
-    ctx->allpassr[i].bufsize = (allpasses[i] + FV_STEREOSPREAD) * multiplier;
+    total += ctx->allpassl[i].bufsize + ctx->allpassr[i].bufsize;
   }
+  zeroset(buf, total * sizeof(float));
+  zeroset(ctx->filterstore, sizeof(ctx->filterstore));
 }
 
 
@@ -160,26 +149,96 @@ void fv_set_width(fv_Context *ctx, float value) {
 }
 
 
-void fv_process(fv_Context *ctx, float *buf, int n) {
-  for (int i = 0; i < n; i += 2) {
-    float outl = 0;
-    float outr = 0;
-    float input = (buf[i] + buf[i + 1]) * ctx->gain;
+void fv_set_offset(fv_Context *ctx, float value) {
+  ctx->offset = value;
+}
+
 
-    /* accumulate comb filters in parallel */
-    for (int i = 0; i < FV_NUMCOMBS; i++) {
-      outl += comb_process(&ctx->combl[i], input);
-      outr += comb_process(&ctx->combr[i], input);
+/* each allpass is run over as much of the block as it can before what it
+** writes comes back out of it */
+static void allpass_block(fv_Line *ap, float *x, int n) {
+  float rd[FV_BLOCKSIZE], wr[FV_BLOCKSIZE];
+  for (int pos = 0; pos < n;) {
+    int len = n - pos < ap->bufsize ? n - pos : ap->bufsize;
+    line_read(ap, rd, len);
+    for (int i = 0; i < len; i++) {
+      float bufout = rd[i];
+      wr[i] = x[pos + i] + bufout * 0.5f;
+      x[pos + i] = -x[pos + i] + bufout;
     }
+    line_write(ap, wr, len);
+    pos += len;
+  }
+}
+
 
-    /* feed through allpasses in series */
-    for (int i = 0; i < FV_NUMALLPASSES; i++) {
-      outl = allpass_process(&ctx->allpassl[i], outl);
-      outr = allpass_process(&ctx->allpassr[i], outr);
+/* `n` is no more than the block size or the shortest comb */
+static void process_block(fv_Context *ctx, const float *inl, const float *inr, float *outl, float *outr, int n) {
+  float input[FV_BLOCKSIZE], l[FV_BLOCKSIZE], r[FV_BLOCKSIZE];
+  float combout[FV_LANES][FV_BLOCKSIZE];
+  float lanes[FV_BLOCKSIZE][FV_LANES];
+
+  for (int i = 0; i < n; i++) {
+    /* the offset is muted along with the input when frozen, as it would
+    ** otherwise build up in the lines */
+    input[i] = (inl[i] + inr[i] + ctx->offset) * ctx->gain;
+  }
+
+  /* nothing a comb writes this block comes back out of it this block, so
+  ** each comb's output for the whole block is read up front */
+  for (int k = 0; k < FV_LANES; k++) {
+    line_read(&ctx->combs[k], combout[k], n);
+    for (int i = 0; i < n; i++) { lanes[i][k] = combout[k][i]; }
+  }
+
+  /* accumulate comb filters in parallel */
+  for (int i = 0; i < n; i++) { l[i] = r[i] = 0; }
+  for (int k = 0; k < FV_NUMCOMBS; k++) {
+    for (int i = 0; i < n; i++) {
+      l[i] += combout[k][i];
+      r[i] += combout[FV_NUMCOMBS + k][i];
+    }
+  }
+
+  /* run the combs' filters side by side, one lane each */
+  float fs[FV_LANES];
+  const float damp1 = ctx->damp1, damp2 = 1.0 - ctx->damp1, feedback = ctx->roomsize1;
+  for (int k = 0; k < FV_LANES; k++) { fs[k] = ctx->filterstore[k]; }
+  for (int i = 0; i < n; i++) {
+    for (int k = 0; k < FV_LANES; k++) {
+      fs[k] = lanes[i][k] * damp2 + fs[k] * damp1;
+      lanes[i][k] = input[i] + fs[k] * feedback;
     }
+  }
+  for (int k = 0; k < FV_LANES; k++) {
+    ctx->filterstore[k] = fs[k];
+    for (int i = 0; i < n; i++) { combout[k][i] = lanes[i][k]; }
+    line_write(&ctx->combs[k], combout[k], n);
+  }
 
-    /* replace buffer with output */
-    buf[i  ] = outl * ctx->wet1 + outr * ctx->wet2 + buf[i  ] * ctx->dry;
-    buf[i+1] = outr * ctx->wet1 + outl * ctx->wet2 + buf[i+1] * ctx->dry;
+  /* feed through allpasses in series */
+  for (int i = 0; i < FV_NUMALLPASSES; i++) {
+    allpass_block(&ctx->allpassl[i], l, n);
+    allpass_block(&ctx->allpassr[i], r, n);
+  }
+
+  for (int i = 0; i < n; i++) {
+    float left  = l[i] * ctx->wet1 + r[i] * ctx->wet2 + inl[i] * ctx->dry;
+    float right = r[i] * ctx->wet1 + l[i] * ctx->wet2 + inr[i] * ctx->dry;
+    outl[i] = left;
+    outr[i] = right;
+  }
+}
+
+
+/* planar input and output; outputs may be the same buffers as the inputs */
+void fv_process(fv_Context *ctx, const float *inl, const float *inr, float *outl, float *outr, int n) {
+  int max = FV_BLOCKSIZE;
+  for (int k = 0; k < FV_LANES; k++) {
+    if (ctx->combs[k].bufsize < max) { max = ctx->combs[k].bufsize; }
+  }
+  for (int pos = 0; pos < n; pos += max) {
+    int len = n - pos < max ? n - pos : max;
+    process_block(ctx, inl + pos, inr + pos, outl + pos, outr + pos, len);
   }
 }
@@ -5,7 +5,11 @@
 ** freeverb v0.1
 **
 ** Public domain C implementation of the original freeverb, with the addition of
-** support for samplerates other than 44.1khz.
+** support for samplerates other than 44.1khz. Delay lines are sized for the
+** samplerate in one buffer given by the caller, and audio is processed in
+** planar blocks with the combs run side by side so the loops vectorize.
+** Denormals are not checked for: the caller should have the cpu flush them
+** to zero, or else set a small offset to be added to the input.
 **
 ** Original C++ version written by Jezard at Dreampoint, June 2000
 */
@@ -28,23 +32,15 @@
 #define FV_INITIALMODE    0.0
 #define FV_INITIALSR      44100.0
 #define FV_FREEZEMODE     0.5
+#define FV_BLOCKSIZE      256 /* samples processed at a time */
+#define FV_LANES          (FV_NUMCOMBS * 2)
 
 
 typedef struct {
-  float feedback;
-  float filterstore;
-  float damp1, damp2;
-  float buf[4096];
+  float *buf;
   int bufsize;
   int bufidx;
-} fv_Comb;
-
-typedef struct {
-  float feedback;
-  float buf[2048];
-  int bufsize;
-  int bufidx;
-} fv_Allpass;
+} fv_Line;
 
 typedef struct {
   float mode;
@@ -54,22 +50,25 @@ typedef struct {
   float wet, wet1, wet2;
   float dry;
   float width;
-  fv_Comb combl[FV_NUMCOMBS];
-  fv_Comb combr[FV_NUMCOMBS];
-  fv_Allpass allpassl[FV_NUMALLPASSES];
-  fv_Allpass allpassr[FV_NUMALLPASSES];
+  float offset; /* keeps the lines clear of denormals */
+  /* left channel's combs then the right's, processed side by side */
+  fv_Line combs[FV_LANES];
+  float filterstore[FV_LANES];
+  fv_Line allpassl[FV_NUMALLPASSES];
+  fv_Line allpassr[FV_NUMALLPASSES];
 } fv_Context;
 
 
-void fv_init(fv_Context *ctx);
+int fv_buffer_size(float samplerate);
+void fv_init(fv_Context *ctx, float samplerate, float *buf);
 void fv_mute(fv_Context *ctx);
-void fv_process(fv_Context *ctx, float *buf, int n);
-void fv_set_samplerate(fv_Context *ctx, float value);
+void fv_process(fv_Context *ctx, const float *inl, const float *inr, float *outl, float *outr, int n);
 void fv_set_mode(fv_Context *ctx, float value);
 void fv_set_roomsize(fv_Context *ctx, float value);
 void fv_set_damp(fv_Context *ctx, float value);
 void fv_set_wet(fv_Context *ctx, float value);
 void fv_set_dry(fv_Context *ctx, float value);
 void fv_set_width(fv_Context *ctx, float value);
+void fv_set_offset(fv_Context *ctx, float value);
 
 #endif